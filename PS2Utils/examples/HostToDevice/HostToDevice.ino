@@ -15,6 +15,14 @@
 static PS2P_GLOBAL(kbd);
 static byte leds = 0;
 
+// Called as each byte of a command has been sent to the keyboard.
+static void writeDone(void* context, byte b, PS2Protocol::WriteStatus status) {
+  if (status != PS2Protocol::WRITE_DONE) {
+    Serial.print(F("*** Unable to send: "));
+    Serial.println(b, HEX);
+  }
+}
+
 void setup() {
   // Initialize debug console.
   Serial.begin(9600);
@@ -26,6 +34,7 @@ void setup() {
     return;
   }
 
+  kbd.setWriteCallback(writeDone);
   Serial.println(F("Ready"));
 }
 
@@ -40,12 +49,15 @@ void loop() {
     Serial.println(b, HEX);
     --count;
 
-    // If this is CAPS_LOCK released, send command to toggle LED.
+    // If this is CAPS_LOCK released, send command to toggle LED.  The
+    // command is queued and sent in the background, so loop() keeps running
+    // while the keyboard clocks it in.
     if (b == 0x58 && last_was_break) {
       Serial.println(F("Toggling CAPS LOCK LED"));
       leds = leds ? 0 : 0x04;
-      kbd.writeAndWait(0xED);
-      kbd.writeAndWait(leds);
+      byte command[] = {0xED, leds};
+      if (!kbd.write(command, 2))
+        Serial.println(F("*** Write queue full"));
     }
 
     last_was_break = b == 0xF0;
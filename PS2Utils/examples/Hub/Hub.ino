@@ -0,0 +1,83 @@
+
+// This example shows how to use the PS2Hub class to read a PS2 keyboard and
+// a PS2 mouse from the same loop().
+//
+// It is important to call the available() method from inside the loop()
+// function, since that is when the bytes received from the devices are
+// decoded.  The budget bounds the number of bytes decoded by each call, so
+// that loop() takes about the same time however fast the devices send.  The
+// events of both devices are read as one stream, oldest first.
+
+#include <ps2_debug.h>
+#include <ps2_hub.h>
+#include <ps2_keyboard.h>
+#include <ps2_mouse.h>
+#include <ps2_mouse_manager.h>
+#include <ps2_protocol.h>
+
+// Global objects to handle the PS2 devices.  Protocols declared without the
+// PS2P_GLOBAL macro get their ISR handler in begin(), so they can be kept in
+// an array.
+static PS2Protocol protocols[2];
+static PS2Protocol& keyboard_protocol = protocols[0];
+static PS2Protocol& mouse_protocol = protocols[1];
+static PS2Keyboard keyboard;
+static PS2Mouse mouse;
+static PS2Hub hub;
+static PS2Debug debug;
+
+void setup() {
+  // Initialize PS2 protocol handlers.  In this example, the keyboard clock
+  // is on pin 2 and its data on pin 4, and the mouse clock is on pin 3 and
+  // its data on pin 5.
+  if (!keyboard_protocol.begin(2, 4, &debug) ||
+      !mouse_protocol.begin(3, 5, &debug)) {
+    Serial.println(F("*** Unable to begin PS2 protocol"));
+    return;
+  }
+
+  if (!keyboard.begin(&keyboard_protocol, &debug) ||
+      !mouse.begin(&mouse_protocol, &debug)) {
+    Serial.println(F("*** Unable to begin PS2 devices"));
+    return;
+  }
+
+  debug.begin(&keyboard_protocol);
+
+  // The mouse only sends packets once reporting is enabled.  The manager is
+  // only needed for that, the hub reads the mouse afterwards.
+  PS2MouseManager manager;
+  if (!manager.begin(&mouse, &debug) || !manager.resetMouse()) {
+    Serial.println(F("*** Unable to reset PS2 mouse"));
+    return;
+  }
+  manager.end();
+
+  hub.addKeyboard(&keyboard);
+  hub.addMouse(&mouse);
+  hub.setBudget(8);
+}
+
+void loop() {
+  debug.dump();
+
+  int count = hub.available();
+  while (count > 0) {
+    PS2Hub::Event event = hub.read();
+    Serial.print(F("Port "));
+    Serial.print(event.port);
+    if (event.isKey()) {
+      Serial.print(F(" key "));
+      Serial.print(event.key.code(), HEX);
+      Serial.println(event.key.isPressed() ? F(" pressed") : F(" released"));
+    } else {
+      Serial.print(F(" buttons "));
+      Serial.print(event.motion.buttons, HEX);
+      Serial.print(F(" X "));
+      Serial.print(event.motion.x);
+      Serial.print(F(" Y "));
+      Serial.println(event.motion.y);
+    }
+    --count;
+  }
+}
@@ -54,7 +54,9 @@ void loop() {
   int count = manager.available();
   while (count > 0) {
     PS2KeyboardManager::Report report = manager.read();
-    debug.dumpReport(report);
+    // Typematic repeats give the same report again, skip those.
+    if (manager.reportChanged())
+      debug.dumpReport(report);
     --count;
   }
 }
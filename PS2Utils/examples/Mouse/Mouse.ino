@@ -0,0 +1,69 @@
+
+// This example shows how to use the PS2Mouse class to read the movement and
+// buttons of a PS2 mouse.  It uses a PS2Protocol to read the stream of bytes
+// from the mouse and assembles them into packets.
+//
+// The mouse is reset and asked for its scroll wheel in setup(), then data
+// reporting is enabled so that the mouse sends packets as it moves.
+//
+// It's more likely that you want to use the PS2MouseManager class if you
+// are interfacing with a PS2 mouse.
+
+#include <ps2_debug.h>
+#include <ps2_mouse.h>
+#include <ps2_protocol.h>
+
+// Global objects to handle PS2 mouse.
+static PS2P_GLOBAL(protocol);
+static PS2Mouse mouse;
+static PS2Debug debug;
+
+void setup() {
+  // Initialize PS2 protocol handler for the mouse.  In this example,
+  // pin 2 is the clock input and pin 3 is the data input.
+  if (!protocol.begin(2, 3, &debug)) {
+    Serial.println(F("*** Unable to begin PS2 protocol"));
+    return;
+  }
+
+  // Initialize PS2 mouse.
+  if (!mouse.begin(&protocol, &debug)) {
+    Serial.println(F("*** Unable to begin PS2 mouse"));
+    return;
+  }
+
+  debug.begin(&protocol);
+
+  // Reset the mouse and give it time to run its self test.  Responds with
+  // ACK (0xFA), then 0xAA and its ID.
+  protocol.writeAndWait(0xFF);
+  delay(500);
+
+  PS2Mouse::MouseType type = mouse.enableExtensions();
+  Serial.print(F("Mouse type "));
+  Serial.println(type, HEX);
+
+  // Enable data reporting.  Responds with ACK (0xFA), which is dropped so
+  // that it is not taken for the start of a packet.
+  mouse.expectAcks(1);
+  protocol.writeAndWait(0xF4);
+}
+
+void loop() {
+  debug.dump();
+
+  // Process each event available.
+  int count = mouse.available();
+  while (count > 0) {
+    PS2Mouse::Event event = mouse.read();
+    Serial.print(F("X "));
+    Serial.print(event.x);
+    Serial.print(F(" Y "));
+    Serial.print(event.y);
+    Serial.print(F(" Wheel "));
+    Serial.print(event.wheel);
+    Serial.print(F(" Buttons "));
+    Serial.println(event.buttons, HEX);
+    --count;
+  }
+}
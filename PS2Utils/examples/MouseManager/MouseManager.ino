@@ -0,0 +1,73 @@
+
+// This example shows how to use the PS2MouseManager class to turn the
+// movement of a PS2 mouse into USB HID mouse reports.
+//
+// It is important to call the available() method from inside the loop()
+// function to make sure that the PS2MouseManager class is always up to date.
+//
+// If you use this class to implement the "device side" of a USB or bluetooth
+// mouse, the data() method of the report gives the bytes to send to the host.
+// Movements larger than a report can hold are split across several reports,
+// and each change of the buttons gets a report of its own.
+
+#include <ps2_debug.h>
+#include <ps2_mouse.h>
+#include <ps2_mouse_manager.h>
+#include <ps2_protocol.h>
+
+// Global objects to handle PS2 mouse.
+static PS2P_GLOBAL(protocol);
+static PS2Mouse mouse;
+static PS2MouseManager manager;
+static PS2Debug debug;
+
+void setup() {
+  // Initialize PS2 protocol handler for the mouse.  In this example,
+  // pin 2 is the clock input and pin 3 is the data input.
+  if (!protocol.begin(2, 3, &debug)) {
+    Serial.println(F("*** Unable to begin PS2 protocol"));
+    return;
+  }
+
+  // Initialize PS2 mouse.
+  if (!mouse.begin(&protocol, &debug)) {
+    Serial.println(F("*** Unable to begin PS2 mouse"));
+    return;
+  }
+
+  // Initialize PS2 mouse manager.
+  if (!manager.begin(&mouse, &debug)) {
+    Serial.println(F("*** Unable to begin PS2 mouse manager"));
+    return;
+  }
+
+  debug.begin(&protocol);
+
+  if (!manager.resetMouse()) {
+    Serial.println(F("*** Unable to reset PS2 mouse"));
+    return;
+  }
+
+  // Report at most once every 8 msec, as a full speed USB host polls, and
+  // let the sample rate go up to 200 per second as long as loop() keeps up.
+  manager.setPollInterval(8);
+  manager.setAdaptiveRate(200);
+}
+
+void loop() {
+  debug.dump();
+
+  int count = manager.available();
+  while (count > 0) {
+    PS2MouseManager::Report report = manager.read();
+    Serial.print(F("Buttons "));
+    Serial.print(report.buttons, HEX);
+    Serial.print(F(" X "));
+    Serial.print(report.x);
+    Serial.print(F(" Y "));
+    Serial.print(report.y);
+    Serial.print(F(" Wheel "));
+    Serial.println(report.wheel);
+    --count;
+  }
+}
@@ -58,12 +58,22 @@ void PS2Debug::dump() {
     Serial.print(F("Protocol: Clocks="));
     Serial.print(protocol_->getClockPulsesForTesting());
     Serial.print(F(" State="));
-    Serial.println(protocol_->getStateForTesting());
+    Serial.print(protocol_->getStateForTesting());
+    Serial.print(F(" Recovered="));
+    Serial.print(protocol_->getFramesRecovered());
+    Serial.print(F(" Dropped="));
+    Serial.print(protocol_->getFramesDropped());
+    Serial.print(F(" Resent="));
+    Serial.print(protocol_->getBytesResent());
+    Serial.print(F(" Resyncs="));
+    Serial.println(protocol_->getResyncs());
   }
 
   if (keyboard_) {
     Serial.print(F("Keyboard: State="));
-    Serial.println(keyboard_->getStateForTesting());
+    Serial.print(keyboard_->getStateForTesting());
+    Serial.print(F(" Filtered="));
+    Serial.println(keyboard_->getRepeatsFiltered());
   }
 
   if (manager_) {
@@ -0,0 +1,199 @@
+
+#include "ps2_hub.h"
+
+#include "ps2_protocol.h"
+
+// Budget that stands for all the bytes received, see setBudget().
+static const int kUnlimitedBudget = 0x7FFF;
+
+const int PS2Hub::kMaxPorts;
+
+PS2Hub::Event::Event() : port(0), type(DEVICE_NONE) {
+#if PS2_TIMESTAMPS
+  timestamp = 0;
+#endif
+}
+
+PS2Hub::PortStats::PortStats()
+    : backlog(0),
+      peak_backlog(0),
+      frames_dropped(0),
+      sync_errors(0),
+      bytes(0),
+      events(0) {
+}
+
+PS2Hub::PS2Hub()
+    : port_count_(0),
+      budget_(0),
+      poll_port_(0),
+      read_port_(0) {
+}
+
+PS2Hub::~PS2Hub() {
+  end();
+}
+
+int PS2Hub::addKeyboard(PS2Keyboard* keyboard) {
+  return keyboard ? addPort(keyboard, 0) : -1;
+}
+
+int PS2Hub::addMouse(PS2Mouse* mouse) {
+  return mouse ? addPort(0, mouse) : -1;
+}
+
+int PS2Hub::poll() {
+  if (port_count_ == 0)
+    return 0;
+
+  // The bytes waiting are measured before any is decoded.
+  for (byte i = 0; i < port_count_; ++i) {
+    Port& port = ports_[i];
+    int backlog = protocol(port)->available();
+    if (backlog > port.peak_backlog)
+      port.peak_backlog = backlog;
+  }
+
+  // One byte from each port in turn, starting one port further each time so
+  // that a small budget is not always spent on the first ports.
+  int budget = budget_ > 0 ? budget_ : kUnlimitedBudget;
+  int decoded = 0;
+  bool progress = true;
+  while (progress && decoded < budget) {
+    progress = false;
+    for (byte i = 0; i < port_count_ && decoded < budget; ++i) {
+      Port& port = ports_[(poll_port_ + i) % port_count_];
+      int count = port.keyboard ? port.keyboard->decodeBytes(1)
+                                : port.mouse->decodeBytes(1);
+      if (count > 0) {
+        ++port.bytes;
+        ++decoded;
+        progress = true;
+      }
+    }
+  }
+
+  poll_port_ = (poll_port_ + 1) % port_count_;
+  return decoded;
+}
+
+int PS2Hub::available() {
+  poll();
+
+  int count = 0;
+  for (byte i = 0; i < port_count_; ++i)
+    count += buffered(ports_[i]);
+  return count;
+}
+
+PS2Hub::Event PS2Hub::read() {
+  Event event;
+  int index = oldestPort();
+  if (index < 0)
+    return event;
+
+  Port& port = ports_[index];
+  event.port = index;
+#if PS2_TIMESTAMPS
+  event.timestamp = PS2Timestamp::expand(nextTimestamp(port), micros());
+#endif
+  if (port.keyboard) {
+    event.type = DEVICE_KEYBOARD;
+    event.key = port.keyboard->read();
+  } else {
+    event.type = DEVICE_MOUSE;
+    event.motion = port.mouse->read();
+  }
+
+  ++port.events;
+  read_port_ = (index + 1) % port_count_;
+  return event;
+}
+
+PS2Hub::PortStats PS2Hub::getStats(int index) const {
+  PortStats stats;
+  if (index < 0 || index >= port_count_)
+    return stats;
+
+  const Port& port = ports_[index];
+  PS2Protocol* ps2_protocol = protocol(port);
+  stats.backlog = ps2_protocol->available();
+  stats.peak_backlog = port.peak_backlog;
+  stats.frames_dropped = ps2_protocol->getFramesDropped() - port.frames_dropped;
+  if (port.mouse)
+    stats.sync_errors = port.mouse->getSyncErrors() - port.sync_errors;
+  stats.bytes = port.bytes;
+  stats.events = port.events;
+  return stats;
+}
+
+void PS2Hub::resetStats() {
+  for (byte i = 0; i < port_count_; ++i)
+    resetPort(&ports_[i]);
+}
+
+void PS2Hub::end() {
+  port_count_ = 0;
+  poll_port_ = 0;
+  read_port_ = 0;
+}
+
+int PS2Hub::addPort(PS2Keyboard* keyboard, PS2Mouse* mouse) {
+  if (port_count_ >= kMaxPorts)
+    return -1;
+
+  Port& port = ports_[port_count_];
+  port.keyboard = keyboard;
+  port.mouse = mouse;
+  resetPort(&port);
+  return port_count_++;
+}
+
+void PS2Hub::resetPort(Port* port) {
+  port->peak_backlog = 0;
+  port->frames_dropped = protocol(*port)->getFramesDropped();
+  port->sync_errors = port->mouse ? port->mouse->getSyncErrors() : 0;
+  port->bytes = 0;
+  port->events = 0;
+}
+
+PS2Protocol* PS2Hub::protocol(const Port& port) {
+  return port.keyboard ? port.keyboard->protocol() : port.mouse->protocol();
+}
+
+int PS2Hub::buffered(const Port& port) {
+  return port.keyboard ? port.keyboard->buffered() : port.mouse->buffered();
+}
+
+byte PS2Hub::nextTimestamp(const Port& port) {
+#if PS2_TIMESTAMPS
+  if (port.keyboard)
+    return port.keyboard->peek().timestamp();
+  return port.mouse->peek().timestamp;
+#else
+  (void)port;
+  return 0;
+#endif
+}
+
+int PS2Hub::oldestPort() const {
+  // Timestamps wrap around, so the oldest event is the one received the
+  // longest before now.  Events received at the same time, or without
+  // timestamps, are taken from the ports in turn.
+  byte now = PS2Timestamp::fromMicros(micros());
+  int oldest = -1;
+  byte oldest_age = 0;
+  for (byte i = 0; i < port_count_; ++i) {
+    byte index = (read_port_ + i) % port_count_;
+    const Port& port = ports_[index];
+    if (buffered(port) == 0)
+      continue;
+
+    byte age = now - nextTimestamp(port);
+    if (oldest < 0 || age > oldest_age) {
+      oldest = index;
+      oldest_age = age;
+    }
+  }
+  return oldest;
+}
@@ -0,0 +1,177 @@
+#ifndef PS2_HUB_H_
+#define PS2_HUB_H_
+
+#include <Arduino.h>
+
+#include "ps2_keyboard.h"
+#include "ps2_mouse.h"
+
+// Number of devices each PS2Hub object can serve, see kMaxPorts below.  This
+// may be defined in the build flags to size the hub for a given board.
+#ifndef PS2HUB_MAX_PORTS
+#define PS2HUB_MAX_PORTS 4
+#endif
+
+/**
+ * Class to serve several PS2 keyboards and mice from one loop().  Each device
+ * is added to a port of the hub, and the events of all the devices are read
+ * from the hub as one stream, oldest first.
+ *
+ * Bytes are decoded one port at a time, one byte from each port in turn, so a
+ * busy device can't keep the others waiting.  The number of bytes decoded by
+ * each call to poll() can be bounded with setBudget(), which keeps the time
+ * spent in loop() predictable however much the devices send; bytes left over
+ * wait in the PS2Protocol buffers, and getStats() tells how full they got.
+ *
+ * With PS2_TIMESTAMPS enabled, the events are ordered by the time their first
+ * byte was received, as long as they are read within 65 milliseconds, see
+ * setBudget().  Otherwise the ports take turns.
+ *
+ * The devices must be initialized (i.e. their begin() methods must have been
+ * called) before they are added, and must not be read from elsewhere while
+ * they are in the hub.  Keyboards must not have a key callback, see
+ * PS2Keyboard::setKeyCallback().  Keyboards may decode their bytes in the ISR
+ * handler, see PS2Keyboard::setDecodeInIsr(), in which case their keys are
+ * read from the hub as they are decoded, and the budget does not apply.
+ */
+class PS2Hub {
+ public:
+  // Kinds of devices, see Event::type.
+  enum DeviceType {
+    DEVICE_NONE,
+    DEVICE_KEYBOARD,
+    DEVICE_MOUSE
+  };
+
+  // Return value of read().  |key| is valid for keyboards and |motion| for
+  // mice.
+  struct Event {
+    Event();
+
+    bool isKey() const { return type == DEVICE_KEYBOARD; }
+    bool isMotion() const { return type == DEVICE_MOUSE; }
+
+    // Port of the device, as returned by addKeyboard() or addMouse().
+    byte port;
+    // One of the DeviceType values, stored as a byte.
+    byte type;
+    PS2Keyboard::Key key;
+    PS2Mouse::Event motion;
+
+#if PS2_TIMESTAMPS
+    // Time in microseconds, as returned by micros(), when the first byte of
+    // the event was received.
+    unsigned long timestamp;
+#endif
+  };
+
+  // Return value of getStats().  Everything but |backlog| is counted since
+  // the device was added or resetStats() was last called.
+  struct PortStats {
+    PortStats();
+
+    // Bytes waiting in the PS2Protocol buffer of the device.
+    int backlog;
+    // Most bytes seen waiting by poll().  Close to PS2Protocol::kBufferSize
+    // means the budget is too small for the device, see setBudget().
+    int peak_backlog;
+    // Bytes dropped by the PS2Protocol, see PS2Protocol::getFramesDropped().
+    uint16_t frames_dropped;
+    // Packets dropped by the mouse, see PS2Mouse::getSyncErrors().  Always
+    // zero for keyboards.
+    uint16_t sync_errors;
+    // Bytes decoded by poll().
+    uint16_t bytes;
+    // Events returned by read().
+    uint16_t events;
+  };
+
+  // Maximum number of devices in the hub.
+  const static int kMaxPorts = PS2HUB_MAX_PORTS;
+
+  PS2Hub();
+  ~PS2Hub();
+
+  // Adds |keyboard| or |mouse| to the next port of the hub.  This is
+  // normally called from the setup() function.  Returns the port, or -1 if
+  // the device is null or the hub is full.
+  int addKeyboard(PS2Keyboard* keyboard);
+  int addMouse(PS2Mouse* mouse);
+
+  // Returns the number of devices in the hub.
+  int ports() const { return port_count_; }
+
+  // Sets the number of bytes each call to poll() decodes at most, over all
+  // the ports.  Zero, the default, decodes all the bytes received.
+  //
+  // Events are ordered by PS2Timestamp values, which wrap around every 65
+  // milliseconds, so events left waiting longer than that by a budget too
+  // small for the devices may be read out of order.
+  void setBudget(int bytes) { budget_ = bytes; }
+  int getBudget() const { return budget_; }
+
+  // Decodes the bytes received from the devices, one byte from each port in
+  // turn, until the budget is spent.  Returns the number of bytes decoded.
+  // available() calls this, so it only needs to be called directly by
+  // sketches that want to decode without reading events.
+  int poll();
+
+  // Polls the devices and returns the number of events available for
+  // reading, from all the ports.
+  int available();
+
+  // Reads the oldest available event.  Should only be called if available()
+  // returns greater than zero.
+  Event read();
+
+  // Returns the statistics of |port|.
+  PortStats getStats(int port) const;
+
+  // Starts counting the statistics of all the ports over.
+  void resetStats();
+
+  // Removes all the devices from the hub.  They can now be used for other
+  // purposes.
+  void end();
+
+ private:
+  struct Port {
+    PS2Keyboard* keyboard;
+    PS2Mouse* mouse;
+
+    // Statistics, see PortStats.  |frames_dropped| and |sync_errors| hold the
+    // counts of the device when counting started.
+    int peak_backlog;
+    uint16_t frames_dropped;
+    uint16_t sync_errors;
+    uint16_t bytes;
+    uint16_t events;
+  };
+
+  // Adds a port for |keyboard| or |mouse|, whichever is not null.
+  int addPort(PS2Keyboard* keyboard, PS2Mouse* mouse);
+
+  // Starts counting the statistics of |port| over.
+  static void resetPort(Port* port);
+
+  static PS2Protocol* protocol(const Port& port);
+  static int buffered(const Port& port);
+
+  // Returns the timestamp of the next event of |port|.  Zero unless
+  // PS2_TIMESTAMPS is enabled.
+  static byte nextTimestamp(const Port& port);
+
+  // Returns the port with the oldest event, or -1 if there is none.
+  int oldestPort() const;
+
+  Port ports_[kMaxPorts];
+  byte port_count_;
+  int budget_;
+
+  // Ports served first by the next poll() and read(), so that each port
+  // gets its turn.
+  byte poll_port_;
+  byte read_port_;
+};
+
+#endif  // PS2_HUB_H_
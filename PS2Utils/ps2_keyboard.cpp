@@ -1,108 +1,25 @@
 
-#define __PROG_TYPES_COMPAT__ 1
 #include "ps2_keyboard.h"
 
 #include <Arduino.h>
 #include "ps2_debug.h"
 #include "ps2_protocol.h"
+#include "ps2_scan_codes.h"
 
-// Maps PS2 keyboard make codes to their coresponding KC_xxx values.
-// See http://www.computer-engineering.org/ps2keyboard/scancodes2.html for
-// details.
+// The tables used to decode make codes into KC_xxx values, and to find the
+// make code of a KC_xxx value, are generated at compile time from the list of
+// keys in ps2_scan_codes.h.
 //
-// Some keys generate one-byte make codes, and others generate two-byte make
-// codes.  There is one exception: the PAUSE key generate a multi-byte make
-// code.
+// There is one decoding table for each scan code set and prefix.  A table
+// only covers the range of make codes used by some key, which is much smaller
+// than the 256 possible bytes, so a lookup is a subtraction and a compare.
+// Bytes outside the range, such as the keyboard's responses to commands, map
+// to KC_INVALID.
 //
-// The first array maps one-byte make codes to KC_xxx values.  The upper part
-// of the array is mostly unused.  While we could save memory by reducing the
-// sizeof the array, this would require extra checks in the code to prevent
-// array out of bounds errors if the keyboard sent incorrect codes.  Since
-// progmem is cheap and plentiful, a full array is used here to simplify the
-// code.
-//
-// The second array maps two-byte make codes to KC_xxx values.  The first byte
-// of the make codes is always 0xE0, so only the second byte is needed to map
-// to a KC_xxx value.  The upper part of this array is also unused, but is
-// included here for the same reason as the first array.
-
-#define KC(x) PS2Keyboard::KC_##x
-#define KCI KC(INVALID)
-
-PROGMEM static const prog_uchar scanCodeToKeyCode[256] = {
-  // 0x
-  KCI,  KC(F9),    KCI, KC(F5), KC(F3),   KC(F1),          KC(F2), KC(F12),
-  KCI, KC(F10), KC(F8), KC(F6), KC(F4),  KC(TAB),  KC(BACK_QUOTE), KCI,
-
-  // 1x
-  KCI, KC(LALT), KC(LSHFT),   KCI, KC(LCTRL), KC(Q), KC(1), KCI,
-  KCI,      KCI,     KC(Z), KC(S),     KC(A), KC(W), KC(2), KCI,
-
-  // 2x
-  KCI,     KC(C), KC(X), KC(D), KC(E), KC(4), KC(3), KCI,
-  KCI, KC(SPACE), KC(V), KC(F), KC(T), KC(R), KC(5), KCI,
-
-  // 3x
-  KCI, KC(N), KC(B), KC(H), KC(G), KC(Y), KC(6), KCI,
-  KCI,   KCI, KC(M), KC(J), KC(U), KC(7), KC(8), KCI,
-
-  // 4x
-  KCI,  KC(COMMA),     KC(K), KC(I),          KC(O), KC(0),      KC(9), KCI,
-  KCI, KC(PERIOD), KC(SLASH), KC(L), KC(SEMI_COLON), KC(P),  KC(MINUS), KCI,
-
-  // 5x
-               KCI,           KCI, KC(QUOTE),               KCI,
-  KC(OPEN_BRACKET),     KC(EQUAL),       KCI,               KCI,
-     KC(CAPS_LOCK),     KC(RSHFT), KC(ENTER), KC(CLOSE_BRACKET),
-               KCI, KC(BACKSLASH),       KCI,               KCI,
-
-  // 6x
-  KCI,      KCI, KCI,      KCI,      KCI, KCI, KC(BACKSPACE), KCI,
-  KCI, KC(KP_1), KCI, KC(KP_4), KC(KP_7), KCI,           KCI, KCI,
-
-  // 7x
-     KC(KP_0), KC(KP_DOT),        KC(KP_2),        KC(KP_5),
-     KC(KP_6),   KC(KP_8),         KC(ESC), KC(KP_NUM_LOCK),
-      KC(F11), KC(KP_ADD),        KC(KP_3),      KC(KP_SUB),
-  KC(KP_MULT),   KC(KP_9), KC(SCROLL_LOCK),             KCI,
-
-  // 8x
-  KCI, KCI, KCI, KC(F7), KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI,    KCI, KCI, KCI, KCI, KCI,
-
-  // 9x
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-
-  // Ax
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-
-  // Bx
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-
-  // Cx
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-
-  // Dx
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-
-  // Ex
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-
-  // Fx
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-};
-
-// NOTE: print screen generate E0 12 E0 7C.  In this table,
-// I ignor the E0 12 part.  There is no key that generates
-// only E0 12 and no key that generate E0 7C alone.  Similarly,
-// I only handle E0 F0 7C for a release of the print screen.
+// NOTE: print screen generate E0 12 E0 7C in set 2.  The E0 12 part is
+// ignored, since there is no key that generates only E0 12 and no key that
+// generate E0 7C alone.  Similarly, only E0 F0 7C is handled for a release of
+// the print screen.
 //
 // The reason for this is that my test keyboard would generate
 // the following byte stream when holding LSHFT and then pressing
@@ -112,81 +29,184 @@ PROGMEM static const prog_uchar scanCodeToKeyCode[256] = {
 //
 // The E0 F0 12 sequence does not make sense, it seems like a
 // keyboard bug.  I'll see when I use it with a real model M.
+//
+// Set 1 has the same fake shifts, E0 2A and E0 AA for example, which are
+// ignored the same way.
 
-PROGMEM static const prog_uchar extScanCodeToKeyCode[256] = {
-  // 0x
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+namespace {
 
-  // 1x
-  KCI, KC(RALT), KCI, KCI, KC(RCTRL), KCI, KCI,      KCI,
-  KCI,      KCI, KCI, KCI,       KCI, KCI, KCI, KC(LGUI),
+// One line of PS2_SCAN_CODES, only used at compile time.
+struct KeyDefinition {
+  byte keycode;
+  uint16_t codes[3];
+};
 
-  // 2x
-  KCI,   KCI,   KCI,   KCI,   KCI,   KCI,   KCI, KC(RGUI),
-  KCI,   KCI,   KCI,   KCI,   KCI,   KCI,   KCI, KC(APPS),
+#define KEY_DEFINITION(name, set1, set2, set3) \
+  {PS2Keyboard::KC_##name, {set1, set2, set3}},
 
-  // 3x
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KC(POWER),
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+constexpr KeyDefinition kKeys[] = {
+  PS2_SCAN_CODES(KEY_DEFINITION)
+};
 
-  // 4x
-  KCI, KCI,        KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KC(KP_DIV), KCI, KCI, KCI, KCI, KCI,
+constexpr int kKeyCount = sizeof(kKeys) / sizeof(kKeys[0]);
 
-  // 5x
-  KCI, KCI, KCI,          KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KC(KP_ENTER), KCI, KCI, KCI, KCI, KCI,
+// Returns true if |key| has a make code in |set| that starts with |prefix|.
+constexpr bool hasCode(const KeyDefinition& key, int set, uint16_t prefix) {
+  return key.codes[set - 1] != 0 && (key.codes[set - 1] & 0xFF00) == prefix;
+}
 
-  // 6x
-  KCI,     KCI, KCI,      KCI,      KCI, KCI, KCI, KCI,
-  KCI, KC(END), KCI, KC(LEFT), KC(HOME), KCI, KCI, KCI,
+// Returns the last byte of the make code of |key| in |set|.
+constexpr byte lastByte(const KeyDefinition& key, int set) {
+  return key.codes[set - 1] & 0xFF;
+}
 
-  // 7x
-  KC(INSERT), KC(DELETE), KC(DOWN), KCI,         KC(RIGHT),   KC(UP), KCI, KCI,
-         KCI,        KCI, KC(PGDN), KCI,  KC(PRINT_SCREEN), KC(PGUP), KCI, KCI,
+// Returns the lowest and highest last bytes of the make codes in |set| that
+// start with |prefix|.  |found| is the result so far.
+constexpr byte firstCode(int set, uint16_t prefix, int i = 0,
+                         byte found = 0xFF) {
+  return i == kKeyCount ? found
+      : firstCode(set, prefix, i + 1,
+                  hasCode(kKeys[i], set, prefix) &&
+                      lastByte(kKeys[i], set) < found
+                  ? lastByte(kKeys[i], set) : found);
+}
 
-  // 8x
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+constexpr byte lastCode(int set, uint16_t prefix, int i = 0,
+                        byte found = 0) {
+  return i == kKeyCount ? found
+      : lastCode(set, prefix, i + 1,
+                 hasCode(kKeys[i], set, prefix) &&
+                     lastByte(kKeys[i], set) > found
+                 ? lastByte(kKeys[i], set) : found);
+}
 
-  // 9x
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+// Returns the KC_xxx value of the make code |code| in |set|.
+constexpr byte findKeyCode(int set, uint16_t code, int i = 0) {
+  return i == kKeyCount ? (byte)PS2Keyboard::KC_INVALID
+      : kKeys[i].codes[set - 1] == code ? kKeys[i].keycode
+      : findKeyCode(set, code, i + 1);
+}
 
-  // Ax
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+// Returns the make code of |keycode| in |set|, or zero.
+constexpr uint16_t findScanCode(int set, byte keycode, int i = 0) {
+  return i == kKeyCount ? 0
+      : kKeys[i].keycode == keycode ? kKeys[i].codes[set - 1]
+      : findScanCode(set, keycode, i + 1);
+}
 
-  // Bx
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+// Returns the highest non-modifier key code with a make code in any set.
+constexpr byte lastKeyCode(int i = 0, byte found = 0) {
+  return i == kKeyCount ? found
+      : lastKeyCode(i + 1,
+                    kKeys[i].keycode < PS2Keyboard::KC_FIRST_MODIFIER_KEYCODE &&
+                        kKeys[i].keycode > found
+                    ? kKeys[i].keycode : found);
+}
 
-  // Cx
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+// Compile time sequence 0, 1, ... N-1, used to expand the tables below.
+template <int... I>
+struct Indices {};
 
-  // Dx
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+template <int N, int... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
 
-  // Ex
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+template <int... I>
+struct MakeIndices<0, I...> {
+  typedef Indices<I...> Type;
+};
 
-  // Fx
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
-  KCI, KCI, KCI, KCI, KCI, KCI, KCI, KCI,
+// Decoding table for the make codes in one set that start with one prefix.
+// |keycodes| is indexed by the last byte of the make code minus |first|.
+template <int Size>
+struct DecodeTable {
+  byte first;
+  byte keycodes[Size];
 };
 
-const int PS2Keyboard::kBufferSize = PS2Keyboard::kBufferArraySize - 1;
+template <int Set, uint16_t Prefix, int... I>
+constexpr DecodeTable<sizeof...(I)> makeDecodeTable(Indices<I...>) {
+  return DecodeTable<sizeof...(I)>{
+    firstCode(Set, Prefix),
+    {findKeyCode(Set, Prefix | (firstCode(Set, Prefix) + I))...}
+  };
+}
+
+template <int Size>
+byte lookup(const DecodeTable<Size>& table, byte code) {
+  byte index = code - pgm_read_byte_near(&table.first);
+  if (index >= Size)
+    return PS2Keyboard::KC_INVALID;
+  return pgm_read_byte_near(table.keycodes + index);
+}
+
+#define DECODE_TABLE(name, set, prefix)                               \
+  PROGMEM const DecodeTable<lastCode(set, prefix) -                   \
+                            firstCode(set, prefix) + 1> name =        \
+      makeDecodeTable<set, prefix>(                                   \
+          MakeIndices<lastCode(set, prefix) -                         \
+                      firstCode(set, prefix) + 1>::Type())
+
+DECODE_TABLE(set1Codes, 1, 0x0000);
+DECODE_TABLE(set1ExtCodes, 1, 0xE000);
+DECODE_TABLE(set2Codes, 2, 0x0000);
+DECODE_TABLE(set2ExtCodes, 2, 0xE000);
+DECODE_TABLE(set3Codes, 3, 0x0000);
+
+// Make codes of each key, indexed by key code.  The non-modifier keys from
+// KC_A are followed by the eight modifier keys.  Set 1 make codes are below
+// 0x80, since the high bit marks break codes, so the high bit is used instead
+// of the 0xE0 prefix.
+struct KeyScanCodes {
+  uint16_t set2;
+  byte set1;
+  byte set3;
+};
+
+constexpr int kNonModifierKeys = lastKeyCode() - PS2Keyboard::KC_A + 1;
+constexpr int kEncodedKeys = kNonModifierKeys + 8;
+
+constexpr byte keyCodeAt(int index) {
+  return index < kNonModifierKeys ? PS2Keyboard::KC_A + index
+      : PS2Keyboard::KC_FIRST_MODIFIER_KEYCODE + index - kNonModifierKeys;
+}
+
+constexpr byte toSet1Byte(uint16_t code) {
+  return (code & 0xFF) | (code > 0xFF ? 0x80 : 0);
+}
+
+template <int Size>
+struct EncodeTable {
+  KeyScanCodes keys[Size];
+};
+
+template <int... I>
+constexpr EncodeTable<sizeof...(I)> makeEncodeTable(Indices<I...>) {
+  return EncodeTable<sizeof...(I)>{{
+    {findScanCode(2, keyCodeAt(I)),
+     toSet1Byte(findScanCode(1, keyCodeAt(I))),
+     (byte)findScanCode(3, keyCodeAt(I))}...
+  }};
+}
+
+PROGMEM const EncodeTable<kEncodedKeys> keyScanCodes =
+    makeEncodeTable(MakeIndices<kEncodedKeys>::Type());
+
+}  // namespace
+
+const int PS2Keyboard::kBufferSize;
 
 PS2Keyboard::PS2Keyboard()
     : ps2_protocol_(0),
       debug_(0),
-      head_(0),
-      tail_(0),
-      state_(WAIT_START) {
+      key_callback_(0),
+      key_context_(0),
+      decode_in_isr_(false),
+      repeat_filter_(false),
+      repeats_filtered_(0),
+      scan_code_set_(SCAN_CODE_SET_2),
+      state_(WAIT_START),
+      timestamp_(0) {
+  memset(held_, 0, sizeof(held_));
 }
 
 PS2Keyboard::~PS2Keyboard() {
@@ -204,25 +224,95 @@ bool PS2Keyboard::begin(PS2Protocol* ps2_protocol, PS2Debug* debug) {
 
 int PS2Keyboard::available() {
   processBytes();
-  int count = (head_ - tail_ + kBufferArraySize) % kBufferArraySize;
+  int count = buffer_.available();
   if (debug_)
     debug_->recordKeyboardAvailable(count);
   return count;
 }
 
 PS2Keyboard::Key PS2Keyboard::read() {
-  // Extract the key code at |tail_| before incrementing it to prevent races.
-  Key key = buffer_[tail_];
-  tail_  = (tail_ + 1) % kBufferArraySize;
-  return key;
+  return buffer_.read();
+}
+
+int PS2Keyboard::decodeBytes(int max_bytes) {
+  // The ISR handler decodes the bytes, see setDecodeInIsr().
+  if (decode_in_isr_)
+    return 0;
+
+  byte timestamp;
+  int count = bytesAvailable();
+  if (count > max_bytes)
+    count = max_bytes;
+  for (int i = 0; i < count; ++i) {
+    byte b = readByte(&timestamp);
+    processByte(b, timestamp);
+  }
+  return count;
+}
+
+void PS2Keyboard::clear() {
+  // The ISR handler may be writing to the buffer, see setDecodeInIsr().
+  noInterrupts();
+  buffer_.clear();
+  interrupts();
+}
+
+void PS2Keyboard::setKeyCallback(KeyCallback callback, void* context) {
+  // Both are changed together, since the callback may be called by the ISR
+  // handler, see setDecodeInIsr().
+  noInterrupts();
+  key_callback_ = callback;
+  key_context_ = context;
+  interrupts();
+}
+
+void PS2Keyboard::setDecodeInIsr(bool enable) {
+  if (!ps2_protocol_)
+    return;
+
+  // Bytes already buffered by the protocol are decoded first, so that keys
+  // stay in order.  Interrupts stay disabled until the frame callback is
+  // installed, so that no byte is received in between.
+  byte timestamp;
+  noInterrupts();
+  while (ps2_protocol_->buffered() > 0) {
+    byte b = readByte(&timestamp);
+    processByte(b, timestamp);
+  }
+  decode_in_isr_ = enable;
+  ps2_protocol_->setFrameCallback(enable ? isrProcessByte : 0, this);
+  interrupts();
+}
+
+void PS2Keyboard::setScanCodeSet(ScanCodeSet set) {
+  // The decoder state may be used by the ISR handler, see setDecodeInIsr().
+  noInterrupts();
+  scan_code_set_ = set;
+  state_ = WAIT_START;
+  interrupts();
+}
+
+void PS2Keyboard::setRepeatFilter(bool enable) {
+  noInterrupts();
+  repeat_filter_ = enable;
+  memset(held_, 0, sizeof(held_));
+  interrupts();
 }
 
 void PS2Keyboard::end() {
+  if (decode_in_isr_)
+    ps2_protocol_->setFrameCallback(0);
+  decode_in_isr_ = false;
   ps2_protocol_ = 0;
   debug_ = 0;
-  head_ = 0;
-  tail_ = 0;
+  key_callback_ = 0;
+  key_context_ = 0;
+  buffer_.clear();
+  scan_code_set_ = SCAN_CODE_SET_2;
   state_ = WAIT_START;
+  timestamp_ = 0;
+  memset(held_, 0, sizeof(held_));
+  repeats_filtered_ = 0;
 }
 
 void PS2Keyboard::handleError(const __FlashStringHelper* error) {
@@ -232,27 +322,151 @@ void PS2Keyboard::handleError(const __FlashStringHelper* error) {
   // TODO: force |ps2_protocol_| to "re-send" byte?
 }
 
-void PS2Keyboard::processByteForTesting(byte b) {
-  processByte(b);
+void PS2Keyboard::processByteForTesting(byte b, byte timestamp) {
+  processByte(b, timestamp);
+}
+
+void PS2Keyboard::isrProcessByte(void* context, byte b, byte timestamp) {
+  static_cast<PS2Keyboard*>(context)->processByte(b, timestamp);
 }
 
 void PS2Keyboard::processBytes() {
-  if (!ps2_protocol_)
+  // The ISR handler decodes the bytes, and may be in the middle of one.
+  // Bytes written to the keyboard still need poll() to be sent.
+  if (decode_in_isr_) {
+    ps2_protocol_->poll();
     return;
+  }
+
+  decodeBytes(bytesAvailable());
+}
+
+bool PS2Keyboard::filterRepeat(Key key) {
+  if (!repeat_filter_ || key.code() == KC_PAUSE)
+    return false;
 
-  int count = ps2_protocol_->available();
-  while (count > 0) {
-    byte b = ps2_protocol_->read();
-    processByte(b);
-    --count;
+  byte index = key.code() / 8;
+  byte mask = 1 << (key.code() % 8);
+  if (key.isReleased()) {
+    held_[index] &= ~mask;
+    return false;
+  }
+
+  if (held_[index] & mask) {
+    ++repeats_filtered_;
+    return true;
   }
+
+  held_[index] |= mask;
+  return false;
 }
 
-void PS2Keyboard::processByte(byte b) {
+int PS2Keyboard::bytesAvailable() {
+  return ps2_protocol_ ? ps2_protocol_->available() : 0;
+}
+
+byte PS2Keyboard::readByte(byte* timestamp) {
+  byte b = ps2_protocol_->read();
+  *timestamp = ps2_protocol_->lastTimestamp();
+  return b;
+}
+
+void PS2Keyboard::processByte(byte b, byte timestamp) {
+  Key key;
+  if (!decodeByte(b, timestamp, &key) || filterRepeat(key))
+    return;
+
+  if (key_callback_) {
+    key_callback_(key_context_, key);
+  } else if (!buffer_.write(key)) {
+    handleError(F("Keyboard buffer overflow"));
+  }
+}
+
+bool PS2Keyboard::decodeByte(byte b, byte timestamp, Key* key) {
+  byte kc;
+  EventType type;
+
+  // A key happens when its first byte arrives.
+  if (state_ == WAIT_START)
+    timestamp_ = timestamp;
+
+  switch (scan_code_set_) {
+    case SCAN_CODE_SET_1:
+      kc = decodeSet1(b, &type);
+      break;
+    case SCAN_CODE_SET_3:
+      kc = decodeSet3(b, &type);
+      break;
+    default:
+      kc = decodeSet2(b, &type);
+      break;
+  }
+
+  if (kc == KC_INVALID)
+    return false;
+
+  *key = Key((KeyCode)kc, type, timestamp_);
+  return true;
+}
+
+byte PS2Keyboard::decodeSet1(byte b, EventType* type) {
+  byte kc = KC_INVALID;
+  *type = (b & 0x80) ? KEY_RELEASED : KEY_PRESSED;
+
+  switch (state_) {
+    case WAIT_START:
+      if (b == 0xE0) {
+        state_ = WAIT_EXTENDED;
+      } else if (b == 0xE1) {
+        // The user pressed Pause/Break.  The full sequence for this key is:
+        //
+        //    E1 1D 45 E1 9D C5
+        //
+        // As in set 2, only these values are allowed before the final C5,
+        // and the Pause key has no break code.
+        state_ = WAIT_C5;
+      } else {
+        kc = lookup(set1Codes, b & 0x7F);
+      }
+      break;
+    case WAIT_EXTENDED:
+      if (b == 0xE0 || b == 0xE1) {
+        handleError(F("EXT while in EXT"));
+      } else {
+        kc = lookup(set1ExtCodes, b & 0x7F);
+        state_ = WAIT_START;
+      }
+      break;
+    case WAIT_C5:
+      switch (b) {
+        case 0xC5:
+          kc = KC_PAUSE;
+          *type = KEY_PRESSED;
+          state_ = WAIT_START;
+          break;
+        case 0x1D:
+        case 0x45:
+        case 0xE1:
+        case 0x9D:
+          break;
+        default:
+          handleError(F("Invalid code in Pause"));
+          break;
+      }
+      break;
+    default:
+      handleError(F("Invalid state"));
+      break;
+  }
+
+  return kc;
+}
+
+byte PS2Keyboard::decodeSet2(byte b, EventType* type) {
   bool is_break = b == 0xF0;
   bool is_extended = b == 0xE0;
   byte kc = KC_INVALID;
-  EventType type;
 
   switch (state_) {
     case WAIT_START:
@@ -271,8 +485,8 @@ void PS2Keyboard::processByte(byte b) {
         // The Pause key has no break code.
         state_ = WAIT_FIRST_77;
       } else {
-        kc = pgm_read_byte_near(scanCodeToKeyCode + b);
-        type = KEY_PRESSED;
+        kc = lookup(set2Codes, b);
+        *type = KEY_PRESSED;
       }
       break;
     case WAIT_EXTENDED:
@@ -281,8 +495,8 @@ void PS2Keyboard::processByte(byte b) {
       } else if (is_break) {
         state_ = WAIT_EXTENDED_BREAK;
       } else {
-        kc = pgm_read_byte_near(extScanCodeToKeyCode + b);
-        type = KEY_PRESSED;
+        kc = lookup(set2ExtCodes, b);
+        *type = KEY_PRESSED;
         state_ = WAIT_START;
       }
       break;
@@ -290,8 +504,8 @@ void PS2Keyboard::processByte(byte b) {
       if (is_break || is_extended) {
         handleError(F("BRK/EXT while in BRK"));
       } else {
-        kc = pgm_read_byte_near(scanCodeToKeyCode + b);
-        type = KEY_RELEASED;
+        kc = lookup(set2Codes, b);
+        *type = KEY_RELEASED;
         state_ = WAIT_START;
       }
       break;
@@ -299,8 +513,8 @@ void PS2Keyboard::processByte(byte b) {
       if (is_break || is_extended) {
         handleError(F("BRK/EXT while in EXT_BRK"));
       } else {
-        kc = pgm_read_byte_near(extScanCodeToKeyCode + b);
-        type = KEY_RELEASED;
+        kc = lookup(set2ExtCodes, b);
+        *type = KEY_RELEASED;
         state_ = WAIT_START;
       }
       break;
@@ -312,7 +526,7 @@ void PS2Keyboard::processByte(byte b) {
             state_ = WAIT_SECOND_77;
           } else {
             kc = KC_PAUSE;
-            type = KEY_PRESSED;
+            *type = KEY_PRESSED;
             state_ = WAIT_START;
           }
           break;
@@ -325,15 +539,63 @@ void PS2Keyboard::processByte(byte b) {
           break;
       }
       break;
+    default:
+      handleError(F("Invalid state"));
+      break;
+  }
+
+  return kc;
+}
+
+byte PS2Keyboard::decodeSet3(byte b, EventType* type) {
+  byte kc = KC_INVALID;
+
+  switch (state_) {
+    case WAIT_START:
+      if (b == 0xF0) {
+        state_ = WAIT_BREAK;
+      } else {
+        kc = lookup(set3Codes, b);
+        *type = KEY_PRESSED;
+      }
+      break;
+    case WAIT_BREAK:
+      if (b == 0xF0) {
+        handleError(F("BRK while in BRK"));
+      } else {
+        kc = lookup(set3Codes, b);
+        *type = KEY_RELEASED;
+        state_ = WAIT_START;
+      }
+      break;
+    default:
+      handleError(F("Invalid state"));
+      break;
+  }
+
+  return kc;
+}
+
+uint16_t PS2Keyboard::scanCode(KeyCode keycode, ScanCodeSet set) {
+  int index;
+  if (keycode >= KC_FIRST_MODIFIER_KEYCODE && keycode < KC_INVALID) {
+    index = kNonModifierKeys + keycode - KC_FIRST_MODIFIER_KEYCODE;
+  } else if (keycode >= KC_A && keycode < KC_A + kNonModifierKeys) {
+    index = keycode - KC_A;
+  } else {
+    return 0;
   }
 
-  if (kc != KC_INVALID) {
-    byte new_head = (head_ + 1) % kBufferArraySize;
-    if (new_head != tail_) {
-      buffer_[head_].set((KeyCode)kc, type);
-      head_  = (head_ + 1) % kBufferArraySize;
-    } else {
-      handleError(F("Keyboard buffer overflow"));
+  const KeyScanCodes* key = keyScanCodes.keys + index;
+  switch (set) {
+    case SCAN_CODE_SET_1: {
+      byte code = pgm_read_byte_near(&key->set1);
+      return (code & 0x80) ? 0xE000 | (code & 0x7F) : code;
     }
+    case SCAN_CODE_SET_2:
+      return pgm_read_word_near(&key->set2);
+    case SCAN_CODE_SET_3:
+      return pgm_read_byte_near(&key->set3);
   }
+  return 0;
 }
@@ -3,13 +3,25 @@
 
 #include <Arduino.h>
 
+#include "ps2_ring_buffer.h"
+#include "ps2_timestamp.h"
+
+// Number of key codes buffered by each PS2Keyboard object, see kBufferSize
+// below.  This may be defined in the build flags to size the buffer for a
+// given board.  It must be a power of two no larger than 128, see
+// PS2RingBuffer.
+#ifndef PS2K_BUFFER_SIZE
+#define PS2K_BUFFER_SIZE 16
+#endif
+
 class PS2Debug;
 class PS2Protocol;
 
 /**
  * Class to decode PS2 make and break codes (collectively known as scan codes)
  * into key codes.  For maximum compatibility with most PS2 keyboards, set 2
- * scan codes are handled.
+ * scan codes are handled by default.  Sets 1 and 3 can be selected with
+ * setScanCodeSet().
  *
  * This class must be connected to a PS2Protocol object which handles all the
  * low level communication with the actual keyboard.  Bytes are read from the
@@ -258,16 +270,36 @@ class PS2Keyboard {
   // it was pressed or released.  Internally, the code and event type are
   // stored as bytes to reduce the amount of memory used.  Unit tests make sure
   // that these values fit into a byte value.
+  //
+  // With PS2_TIMESTAMPS enabled, the key also holds the PS2Timestamp of the
+  // first byte of its scan code.
   class Key {
    public:
-    Key() : code_(KC_INVALID), type_(KEY_PRESSED) {}
-    Key(KeyCode code, EventType type)
+    Key() : code_(KC_INVALID), type_(KEY_PRESSED) {
+#if PS2_TIMESTAMPS
+      timestamp_ = 0;
+#endif
+    }
+    Key(KeyCode code, EventType type, byte timestamp=0)
         : code_((KeyCode)code),
-          type_((EventType)type) {}
+          type_((EventType)type) {
+#if PS2_TIMESTAMPS
+      timestamp_ = timestamp;
+#endif
+    }
 
     KeyCode code() const { return (KeyCode) code_; }
     EventType type() const { return (EventType) type_; }
 
+    // Always zero unless PS2_TIMESTAMPS is enabled.
+    byte timestamp() const {
+#if PS2_TIMESTAMPS
+      return timestamp_;
+#else
+      return 0;
+#endif
+    }
+
     bool isPressed() const { return type_ == KEY_PRESSED; }
     bool isReleased() const { return type_ == KEY_RELEASED; }
 
@@ -279,12 +311,26 @@ class PS2Keyboard {
    private:
     byte code_;
     byte type_;
+#if PS2_TIMESTAMPS
+    byte timestamp_;
+#endif
   };
 
   // Number of decoded key codes that can be buffered by PS2Keyboard.  If the
   // buffer overflows, newer codes will be dropped with errors reported to
   // the error handler.
-  const static int kBufferSize;
+  const static int kBufferSize = PS2K_BUFFER_SIZE;
+
+  // Scan code sets that can be decoded, see setScanCodeSet().
+  enum ScanCodeSet {
+    SCAN_CODE_SET_1 = 1,
+    SCAN_CODE_SET_2 = 2,
+    SCAN_CODE_SET_3 = 3
+  };
+
+  // Called for each decoded key when set with setKeyCallback().  |context| is
+  // the value passed to setKeyCallback().
+  typedef void (*KeyCallback)(void* context, Key key);
 
   PS2Keyboard();
   ~PS2Keyboard();
@@ -306,6 +352,93 @@ class PS2Keyboard {
   // and wither the key was pressed or released.
   Key read();
 
+  // Returns the next available key code without removing it.  Should only be
+  // called if available() returns greater than zero.
+  Key peek() const { return buffer_.peek(); }
+
+  // Decodes at most |max_bytes| of the bytes received from the keyboard and
+  // returns how many were decoded.  available() decodes all of them, this
+  // lets a sketch bound the time spent on each of several devices, see
+  // PS2Hub.  Always returns zero while decoding in the ISR handler, see
+  // setDecodeInIsr().
+  int decodeBytes(int max_bytes);
+
+  // Returns the number of key codes available for reading, without decoding
+  // any more bytes.
+  int buffered() const { return buffer_.available(); }
+
+  // Drops the key codes decoded but not read yet.
+  void clear();
+
+  // Registers a function to be called with each key as soon as it is decoded,
+  // instead of buffering it for read().  Keys are decoded when available() is
+  // called, so it should still be called regularly from loop().  Pass zero
+  // to go back to buffering keys.
+  void setKeyCallback(KeyCallback callback, void* context=0);
+
+  // When enabled, bytes are decoded as soon as they are received, from the
+  // ISR handler of the PS2Protocol, and only the decoded keys are buffered.
+  // Keys are then available to loop() right away, and the PS2Protocol buffer
+  // is no longer used, so PS2P_BUFFER_SIZE can be made smaller.  The key
+  // callback and the error handler are then also called from the ISR handler.
+  // Disabled by default.
+  void setDecodeInIsr(bool enable);
+  bool getDecodeInIsr() const { return decode_in_isr_; }
+
+  // Selects the scan code set used to decode the bytes from the keyboard.
+  // This does not change the set sent by the keyboard, which is done with the
+  // 0xF0 command, see PS2KeyboardManager::selectScanCodeSet().  Set 2 by
+  // default.
+  void setScanCodeSet(ScanCodeSet set);
+  ScanCodeSet getScanCodeSet() const { return (ScanCodeSet)scan_code_set_; }
+
+  // Returns the make code of |keycode| in scan code |set|, or zero if the key
+  // has none.  Make codes prefixed with 0xE0 are returned with the prefix in
+  // the high byte.  The Pause key has no make code in sets 1 and 2, since it
+  // sends a sequence of its own.
+  static uint16_t scanCode(KeyCode keycode, ScanCodeSet set);
+
+  // When enabled, a key pressed again while already held down, as the
+  // keyboard does when repeating a key, is dropped instead of being returned.
+  // The Pause key, which has no break code, is never dropped.  Disabled by
+  // default.
+  void setRepeatFilter(bool enable);
+
+  // Number of key presses dropped by the repeat filter since begin().
+  // Consumers that want to repeat keys themselves can watch it change.
+  uint16_t getRepeatsFiltered() const { return repeats_filtered_; }
+
+  // Decodes all bytes received from the PS2 keyboard and calls |handler| with
+  // each key, without going through the buffer.  |handler| may be a function
+  // or an object with an operator() taking a Key, and is bound at compile
+  // time.  Keys that were already buffered are handled first.
+  //
+  //     struct Handler {
+  //       void operator()(PS2Keyboard::Key key) {
+  //         // Do something with key.
+  //       }
+  //     } handler;
+  //
+  //     void loop() {
+  //       keyboard.dispatch(handler);
+  //     }
+  template <typename Handler>
+  void dispatch(Handler& handler) {
+    while (buffer_.available() > 0)
+      handler(buffer_.read());
+
+    Key key;
+    byte b;
+    byte timestamp;
+    int count = bytesAvailable();
+    while (count > 0) {
+      b = readByte(&timestamp);
+      if (decodeByte(b, timestamp, &key) && !filterRepeat(key))
+        handler(key);
+      --count;
+    }
+  }
+
   // Disable the PS2 keyboard object.  The PS2Protocol given to begin() can
   // now be used for other purposes.
   void end();
@@ -315,7 +448,7 @@ class PS2Keyboard {
 
   // This is used for testing the PS2Keyboard class.  Does not need to be
   // called in regular programs.
-  void processByteForTesting(byte b);
+  void processByteForTesting(byte b, byte timestamp=0);
 
   // States while decoding bytes.
   enum State {
@@ -330,18 +463,39 @@ class PS2Keyboard {
 
     // The following states are for handling the very special Pause/Break key.
     WAIT_FIRST_77,
-    WAIT_SECOND_77
+    WAIT_SECOND_77,
+    // Set 1 Pause/Break key.
+    WAIT_C5
   };
 
   State getStateForTesting() const { return state_; }
 
  private:
-  const static int kBufferArraySize = 17;
-
   // Reads as many bytes as possible from the PS2 protocol object, filling the
   // buffer with key codes.
   void processBytes();
-  void processByte(byte b);
+  void processByte(byte b, byte timestamp);
+
+  // PS2Protocol frame callback for setDecodeInIsr().
+  static void isrProcessByte(void* context, byte b, byte timestamp);
+
+  // Feeds one byte to the decoder.  Returns true, with the key in |key|, if
+  // the byte completes a scan code.
+  bool decodeByte(byte b, byte timestamp, Key* key);
+
+  // Decoders for each scan code set, called by decodeByte().  Return the key
+  // code, or KC_INVALID if |b| does not complete a scan code, and set |type|.
+  byte decodeSet1(byte b, EventType* type);
+  byte decodeSet2(byte b, EventType* type);
+  byte decodeSet3(byte b, EventType* type);
+
+  // Returns true if |key| should be dropped by the repeat filter.
+  bool filterRepeat(Key key);
+
+  // Access to the PS2 protocol object for dispatch(), which can't use it
+  // directly since PS2Protocol is only declared here.
+  int bytesAvailable();
+  byte readByte(byte* timestamp);
 
   // Handles an error while deooding bytes from the keyboard.
   void handleError(const __FlashStringHelper* error);
@@ -349,20 +503,29 @@ class PS2Keyboard {
   PS2Protocol* ps2_protocol_;
   PS2Debug* debug_;
 
-  // Circular buffer holding key codes decoded from PS2 keyboard.  Note the
-  // following conditions:
-  //
-  //   0 <= head_ < sizeof(buffer_) / sizeof(byte)
-  //   0 <= tail_ < sizeof(buffer_) / sizeof(byte)
-  //   head_ == tail_ : the buffer is empty
-  //   head_ + 1 == tail_ : buffer is full
-  byte head_;
-  byte tail_;
-  Key buffer_[kBufferArraySize];
+  // Key codes decoded from PS2 keyboard.
+  PS2RingBuffer<Key, kBufferSize> buffer_;
+
+  KeyCallback key_callback_;
+  void* key_context_;
+
+  bool decode_in_isr_;
+
+  // Repeat filter.  |held_| has one bit per key code, set while the key is
+  // held down.
+  bool repeat_filter_;
+  byte held_[256 / 8];
+  uint16_t repeats_filtered_;
+
+  // One of the ScanCodeSet values, stored as a byte.
+  byte scan_code_set_;
 
   // State of the protocol while reading a byte.  Can be one of the ReadState
   // values.  This variable is only accessed from the ISR handler.
   State state_;
+
+  // Timestamp of the first byte of the scan code being decoded.
+  byte timestamp_;
 };
 
 #endif  // PS2_KEYBOARD_H_
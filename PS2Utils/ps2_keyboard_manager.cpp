@@ -15,19 +15,40 @@ static const PS2Keyboard::KeyCode kRGUI = PS2Keyboard::KC_RGUI;
 
 #define numberof(a) (sizeof(a)/sizeof((a)[0]))
 
-PS2KeyboardManager::Report::Report() : modifiers(0) {
+// Mask of the bits of the last byte of NkroReport::keys that are key codes.
+static const byte kNkroLastByteMask =
+    0xFF >> (PS2KeyboardManager::NkroReport::kKeyBytes * 8 -
+             PS2KeyboardManager::NkroReport::kKeyBits);
+
+const int PS2KeyboardManager::Report::kSize;
+const int PS2KeyboardManager::NkroReport::kKeyBits;
+const int PS2KeyboardManager::NkroReport::kKeyBytes;
+const int PS2KeyboardManager::NkroReport::kSize;
+
+PS2KeyboardManager::Report::Report() : modifiers(0), reserved(0) {
   memset(keycodes, 0, sizeof(keycodes));
+#if PS2_TIMESTAMPS
+  timestamp = 0;
+#endif
 }
 
 PS2KeyboardManager::Report::Report(const PS2KeyboardManager::Report& other)
-    : modifiers(other.modifiers) {
+    : modifiers(other.modifiers),
+      reserved(0) {
   memcpy(keycodes, other.keycodes, sizeof(keycodes));
+#if PS2_TIMESTAMPS
+  timestamp = other.timestamp;
+#endif
 }
 
 void PS2KeyboardManager::Report::operator=(
     const PS2KeyboardManager::Report& other) {
   modifiers = other.modifiers;
+  reserved = 0;
   memcpy(keycodes, other.keycodes, sizeof(keycodes));
+#if PS2_TIMESTAMPS
+  timestamp = other.timestamp;
+#endif
 }
 
 bool PS2KeyboardManager::Report::isShiftPressed() {
@@ -54,13 +75,42 @@ bool PS2KeyboardManager::Report::isKeyPressed(PS2Keyboard::KeyCode keycode) {
   return false;
 }
 
+PS2KeyboardManager::NkroReport::NkroReport() : modifiers(0) {
+  memset(keys, 0, sizeof(keys));
+#if PS2_TIMESTAMPS
+  timestamp = 0;
+#endif
+}
+
+bool PS2KeyboardManager::NkroReport::isKeyPressed(
+    PS2Keyboard::KeyCode keycode) {
+  if (keycode >= kKeyBits)
+    return false;
+  return (keys[keycode / 8] & (1 << (keycode % 8))) != 0;
+}
+
 PS2KeyboardManager::PS2KeyboardManager()
     : last_report_(0),
+      clock_(millis),
+      poll_interval_(0),
       ps2_keyboard_(0),
       debug_(0),
       interval_(0),
-      leds_(0) {
+      keys_down_count_(0),
+      keys_down_total_(0),
+      dirty_(false),
+      report_changed_(false),
+      report_stale_(false),
+      leds_(0),
+      leds_changed_(false),
+      leds_sent_(false),
+      coalesce_keys_(false),
+      repeat_delay_(0),
+      repeat_period_(0),
+      repeat_key_(PS2Keyboard::KC_NO_EVENT),
+      repeat_next_(0) {
   memset(pressed_, 0, sizeof(pressed_));
+  resetKeyModes();
 }
 
 PS2KeyboardManager::~PS2KeyboardManager() {
@@ -76,14 +126,24 @@ bool PS2KeyboardManager::begin(PS2Keyboard* ps2_keyboard,
   ps2_keyboard_ = ps2_keyboard;
   debug_ = debug;
   interval_ = interval;
+  resetKeyModes();
   // TODO: send a reset command to keyboard?
   return true;
 }
 
 int PS2KeyboardManager::available() {
+  syncLEDs();
+
   int count = ps2_keyboard_->available();
-  if (count == 0 && interval_ > 0) {
-    if (millis() - last_report_ > interval_)
+  if (count == 0 && repeatDue())
+    count = 1;
+
+  unsigned long elapsed = clock_() - last_report_;
+  if (count > 0 && poll_interval_ > 0) {
+    // One report per poll interval holds all the pending keys.
+    count = elapsed >= (unsigned long)poll_interval_ ? 1 : 0;
+  } else if (count == 0 && interval_ > 0) {
+    if (elapsed >= (unsigned long)interval_)
       count = 1;
   }
   if (debug_)
@@ -92,25 +152,97 @@ int PS2KeyboardManager::available() {
 }
 
 PS2KeyboardManager::Report PS2KeyboardManager::read() {
-  if (ps2_keyboard_->available() > 0)
-    processKey(transformKey(ps2_keyboard_->read()));
-
-  // See page 62-63 in HID11_1.pdf for more details.
-  Report report;
-  report.modifiers |= isKeyPressed(PS2Keyboard::KC_LSHFT) ? M_LSHFT : 0;
-  report.modifiers |= isKeyPressed(PS2Keyboard::KC_LCTRL) ? M_LCTRL : 0;
-  report.modifiers |= isKeyPressed(PS2Keyboard::KC_LALT) ? M_LALT : 0;
-  report.modifiers |= isKeyPressed(PS2Keyboard::KC_LGUI) ? M_LGUI : 0;
-
-  report.modifiers |= isKeyPressed(PS2Keyboard::KC_RSHFT) ? M_RSHFT : 0;
-  report.modifiers |= isKeyPressed(PS2Keyboard::KC_RCTRL) ? M_RCTRL : 0;
-  report.modifiers |= isKeyPressed(PS2Keyboard::KC_RALT) ? M_RALT : 0;
-  report.modifiers |= isKeyPressed(PS2Keyboard::KC_RGUI) ? M_RGUI : 0;
-
-  collectKeysDown(&report);
+#if PS2_TIMESTAMPS
+  unsigned long timestamp = applyKeys();
+#else
+  applyKeys();
+#endif
+  if (report_stale_) {
+    report_stale_ = false;
+
+    // See page 62-63 in HID11_1.pdf for more details.  The modifier key codes
+    // are in the same order as the modifier bits, so the byte of |pressed_|
+    // that holds them is the modifiers byte.
+    report_.modifiers = pressed_[PS2Keyboard::KC_FIRST_MODIFIER_KEYCODE / 8];
+
+    memset(report_.keycodes, 0, sizeof(report_.keycodes));
+    collectKeysDown(&report_);
+    releaseNoBreakKeys();
+  }
+
+  Report report(report_);
+#if PS2_TIMESTAMPS
+  report.timestamp = timestamp;
+#endif
   return report;
 }
 
+PS2KeyboardManager::NkroReport PS2KeyboardManager::readNkro() {
+#if PS2_TIMESTAMPS
+  unsigned long timestamp = applyKeys();
+#else
+  applyKeys();
+#endif
+
+  // The bitmap of pressed keys is already in the layout of the report.
+  NkroReport report;
+  report.modifiers = pressed_[PS2Keyboard::KC_FIRST_MODIFIER_KEYCODE / 8];
+  memcpy(report.keys, pressed_, sizeof(report.keys));
+  report.keys[NkroReport::kKeyBytes - 1] &= kNkroLastByteMask;
+#if PS2_TIMESTAMPS
+  report.timestamp = timestamp;
+#endif
+
+  releaseNoBreakKeys();
+  return report;
+}
+
+unsigned long PS2KeyboardManager::applyKeys() {
+  last_report_ = clock_();
+
+  unsigned long timestamp = 0;
+  if (ps2_keyboard_->available() > 0) {
+    PS2Keyboard::Key raw = ps2_keyboard_->read();
+#if PS2_TIMESTAMPS
+    timestamp = PS2Timestamp::expand(raw.timestamp(), micros());
+#endif
+    PS2Keyboard::Key key = transformKey(raw);
+    processKey(key, raw.code());
+
+    if (coalesce_keys_ || poll_interval_ > 0) {
+      // Keys that changed in this report.
+      byte changed[kMaskSize];
+      memset(changed, 0, sizeof(changed));
+      changed[key.code() / 8] |= 1 << (key.code() % 8);
+
+      while (ps2_keyboard_->available() > 0) {
+        raw = ps2_keyboard_->peek();
+        key = transformKey(raw);
+        int index = key.code() / 8;
+        int bit = key.code() % 8;
+        if (changed[index] & (1 << bit))
+          break;
+
+        changed[index] |= 1 << bit;
+        ps2_keyboard_->read();
+        processKey(key, raw.code());
+      }
+    }
+  } else if (repeatDue()) {
+    repeat_next_ = last_report_ + repeat_period_;
+    PS2Keyboard::Key raw((PS2Keyboard::KeyCode)repeat_key_,
+                         PS2Keyboard::KEY_PRESSED);
+    processKey(transformKey(raw), raw.code());
+  }
+
+  report_changed_ = dirty_;
+  if (dirty_) {
+    dirty_ = false;
+    report_stale_ = true;
+  }
+  return timestamp;
+}
+
 bool PS2KeyboardManager::isShiftPressed() {
   return isKeyPressed(PS2Keyboard::KC_LSHFT) ||
       isKeyPressed(PS2Keyboard::KC_RSHFT);
@@ -139,8 +271,12 @@ bool PS2KeyboardManager::isKeyPressed(PS2Keyboard::KeyCode keycode) {
 
 void PS2KeyboardManager::resetKeyboard() {
   ps2_keyboard_->protocol()->writeAndWait(0xFF);  // Responds with ACK (0xFA)
-  memset(pressed_, 0, sizeof(pressed_));
+  ps2_keyboard_->setScanCodeSet(PS2Keyboard::SCAN_CODE_SET_2);
+  clearKeys();
+  resetKeyModes();
   leds_ = 0;
+  leds_changed_ = false;
+  leds_sent_ = false;
 }
 
 void PS2KeyboardManager::setTypematicRateAndDelay(byte arg) {
@@ -148,31 +284,177 @@ void PS2KeyboardManager::setTypematicRateAndDelay(byte arg) {
   ps2_keyboard_->protocol()->writeAndWait(arg);  // Responds with ACK (0xFA)
 }
 
+bool PS2KeyboardManager::setSoftwareTypematic(unsigned int delay,
+                                              unsigned int period) {
+  if (!ps2_keyboard_)
+    return false;
+
+  PS2Protocol* protocol = ps2_keyboard_->protocol();
+  if (ps2_keyboard_->getScanCodeSet() == PS2Keyboard::SCAN_CODE_SET_3) {
+    // All keys make/break, or all keys typematic/make/break.
+    byte command = delay > 0 ? 0xF8 : 0xFA;
+    if (!protocol->write(&command, 1))
+      return false;
+    resetKeyModes();
+  } else {
+    // Slowest rate and longest delay, or the default 10.9 per second after
+    // 500 msec.
+    byte command[] = {0xF3, (byte)(delay > 0 ? 0x7F : 0x2B)};
+    if (!protocol->write(command, 2))
+      return false;
+  }
+
+  repeat_delay_ = delay;
+  repeat_period_ = period;
+  repeat_key_ = PS2Keyboard::KC_NO_EVENT;
+  return true;
+}
+
+bool PS2KeyboardManager::selectScanCodeSet(PS2Keyboard::ScanCodeSet set) {
+  // The response is read from the protocol, so it must not be decoded by the
+  // ISR handler meanwhile.
+  if (!ps2_keyboard_->getDecodeInIsr())
+    return negotiateScanCodeSet(set);
+
+  ps2_keyboard_->setDecodeInIsr(false);
+  bool selected = negotiateScanCodeSet(set);
+  ps2_keyboard_->setDecodeInIsr(true);
+  return selected;
+}
+
+bool PS2KeyboardManager::negotiateScanCodeSet(PS2Keyboard::ScanCodeSet set) {
+  PS2Protocol* protocol = ps2_keyboard_->protocol();
+
+  // Select the set, then ask the keyboard which set it uses, since keyboards
+  // that do not support the set still acknowledge the command.  Each byte
+  // responds with ACK (0xFA).
+  byte command[] = {0xF0, (byte)set, 0xF0, 0x00};
+  int current = protocol->command(command, numberof(command));
+  if (current < PS2Keyboard::SCAN_CODE_SET_1 ||
+      current > PS2Keyboard::SCAN_CODE_SET_3) {
+    if (debug_)
+      debug_->ErrorHandler(F("No response to scan code set"));
+    return false;
+  }
+
+  ps2_keyboard_->setScanCodeSet((PS2Keyboard::ScanCodeSet)current);
+  ps2_keyboard_->clear();
+  clearKeys();
+  resetKeyModes();
+  if (current != set)
+    return false;
+
+  // Put all keys in a known mode, since the default modes of set 3 vary
+  // between keyboards.  Keys repeated in software only need make/break.
+  if (set == PS2Keyboard::SCAN_CODE_SET_3)
+    return protocol->writeAndWait(repeat_delay_ > 0 ? 0xF8 : 0xFA);
+  return true;
+}
+
+bool PS2KeyboardManager::setKeyMode(PS2Keyboard::KeyCode keycode,
+                                    KeyMode mode) {
+  byte code = PS2Keyboard::scanCode(keycode, PS2Keyboard::SCAN_CODE_SET_3);
+  bool has_break = mode == KEY_MODE_MAKE_BREAK;
+  if (ps2_keyboard_->getScanCodeSet() != PS2Keyboard::SCAN_CODE_SET_3 ||
+      code == 0 || (!has_break && keycode >= NkroReport::kKeyBits)) {
+    return false;
+  }
+
+  // The keyboard takes the make codes that follow the command, until the next
+  // command.  Each byte responds with ACK (0xFA).
+  PS2Protocol* protocol = ps2_keyboard_->protocol();
+  if (!protocol->writeAndWait(mode) || !protocol->writeAndWait(code))
+    return false;
+
+  byte mask = 1 << (keycode % 8);
+  if (has_break) {
+    no_break_[keycode / 8] &= ~mask;
+  } else {
+    no_break_[keycode / 8] |= mask;
+  }
+  return true;
+}
+
+bool PS2KeyboardManager::repeatDue() {
+  return repeat_key_ != PS2Keyboard::KC_NO_EVENT &&
+      (long)(clock_() - repeat_next_) >= 0;
+}
+
 void PS2KeyboardManager::setLEDs(byte mask, byte leds) {
   leds_ &= ~mask;
   leds_ |= mask & leds;
-  ps2_keyboard_->protocol()->writeAndWait(0xED);  // Responds with ACK (0xFA)
-  ps2_keyboard_->protocol()->writeAndWait(leds_);  // Responds with ACK (0xFA)
+  leds_changed_ = true;
+}
+
+void PS2KeyboardManager::syncLEDs() {
+  if (!leds_changed_ && !leds_sent_)
+    return;
+
+  // Waiting for earlier writes to complete keeps at most one LED command in
+  // flight.  Both bytes are queued together so that nothing else can be sent
+  // between them.
+  PS2Protocol* protocol = ps2_keyboard_->protocol();
+  if (!protocol || protocol->writePending() > 0)
+    return;
+
+  // A command that failed is sent again.  The status is that of the last
+  // byte written, which may follow the command if the sketch also writes, in
+  // which case the LEDs may be sent once more than needed.
+  if (leds_sent_) {
+    leds_sent_ = false;
+    if (protocol->writeStatus() != PS2Protocol::WRITE_DONE)
+      leds_changed_ = true;
+  }
+  if (!leds_changed_)
+    return;
+
+  byte command[] = {0xED, leds_};  // Each responds with ACK (0xFA)
+  if (protocol->write(command, 2)) {
+    leds_changed_ = false;
+    leds_sent_ = true;
+  }
 }
 
 void PS2KeyboardManager::end() {
   last_report_ = 0;
   ps2_keyboard_ = 0;
-  memset(pressed_, 0, sizeof(pressed_));
+  clearKeys();
+  resetKeyModes();
   leds_ = 0;
+  leds_changed_ = false;
+  leds_sent_ = false;
 }
 
 PS2Keyboard::Key PS2KeyboardManager::transformKey(PS2Keyboard::Key key) {
   return key;
 }
 
-void PS2KeyboardManager::processKey(PS2Keyboard::Key key) {
+void PS2KeyboardManager::processKey(PS2Keyboard::Key key, byte raw_code) {
   int index = key.code() / 8;
   int bit = key.code() % 8;
+  bool was_pressed = (pressed_[index] & (1 << bit)) != 0;
+  bool tracked = key.code() < PS2Keyboard::KC_COUNT_NON_MODIFIER_KEYCODE;
   if (key.type() == PS2Keyboard::KEY_PRESSED) {
     pressed_[index] |= 1 << bit;
+    if (!was_pressed) {
+      dirty_ = true;
+      if (tracked) {
+        addKeyDown(key.code());
+        if (repeat_delay_ > 0) {
+          repeat_key_ = raw_code;
+          repeat_next_ = clock_() + repeat_delay_;
+        }
+      }
+    }
   } else {
     pressed_[index] &= ~(1 << bit);
+    if (was_pressed) {
+      dirty_ = true;
+      if (tracked)
+        removeKeyDown(key.code());
+      if (raw_code == repeat_key_)
+        repeat_key_ = PS2Keyboard::KC_NO_EVENT;
+    }
 
     // Handle LEDs.
     byte mask = 0;
@@ -195,29 +477,81 @@ void PS2KeyboardManager::processKey(PS2Keyboard::Key key) {
 }
 
 void PS2KeyboardManager::collectKeysDown(Report* report) {
-  int pos = 0;
-  for (PS2Keyboard::KeyCode kc = PS2Keyboard::KC_FIRST_NON_MODIFIER_KEYCODE;
-       kc < PS2Keyboard::KC_COUNT_NON_MODIFIER_KEYCODE;
-       kc = static_cast<PS2Keyboard::KeyCode>(kc + 1)) {
-    if (isKeyPressed(kc)) {
-      if  (pos == numberof(report->keycodes))
-        break;
+  // If more keys are pressed than can fit into the report, return a phantom
+  // state by setting all keycoes to ERROR_ROLL_OVER.
+  if (keys_down_total_ > numberof(report->keycodes)) {
+    memset(report->keycodes, PS2Keyboard::KC_ERROR_ROLL_OVER,
+           numberof(report->keycodes));
+    return;
+  }
 
-      report->keycodes[pos++] = kc;
+  memcpy(report->keycodes, keys_down_, keys_down_count_);
+}
 
-      // Workaround for missing break code for the Pause key.
-      if (kc == PS2Keyboard::KC_PAUSE) {
-        int index = kc / 8;
-        int bit = kc % 8;
-        pressed_[index] &= ~(1 << bit);
+void PS2KeyboardManager::releaseNoBreakKeys() {
+  for (byte i = 0; i < sizeof(no_break_); ++i) {
+    byte held = pressed_[i] & no_break_[i];
+    for (byte bit = 0; held != 0; ++bit, held >>= 1) {
+      if (held & 1) {
+        // The key as received is not known here.  A key remapped to one
+        // without a break code stops repeating at its own break code.
+        byte code = i * 8 + bit;
+        processKey(PS2Keyboard::Key((PS2Keyboard::KeyCode)code,
+                                    PS2Keyboard::KEY_RELEASED), code);
       }
     }
   }
+}
 
-  // If more keys are pressed than can fit into the report, return a phantom
-  // state by setting all keycoes to ERROR_ROLL_OVER.
-  if (pos == numberof(report->keycodes)) {
-    memset(report->keycodes, PS2Keyboard::KC_ERROR_ROLL_OVER,
-           numberof(report->keycodes));
+void PS2KeyboardManager::resetKeyModes() {
+  memset(no_break_, 0, sizeof(no_break_));
+
+  // Pause only lacks a break code in sets 1 and 2.  In set 3 it has one,
+  // like all the other keys until setKeyMode() is called.
+  if (!ps2_keyboard_ ||
+      ps2_keyboard_->getScanCodeSet() != PS2Keyboard::SCAN_CODE_SET_3) {
+    no_break_[PS2Keyboard::KC_PAUSE / 8] |= 1 << (PS2Keyboard::KC_PAUSE % 8);
   }
 }
+
+void PS2KeyboardManager::addKeyDown(byte keycode) {
+  ++keys_down_total_;
+  if (keys_down_count_ < kMaxKeysDown)
+    keys_down_[keys_down_count_++] = keycode;
+}
+
+void PS2KeyboardManager::removeKeyDown(byte keycode) {
+  --keys_down_total_;
+  for (byte i = 0; i < keys_down_count_; ++i) {
+    if (keys_down_[i] == keycode) {
+      --keys_down_count_;
+      memmove(keys_down_ + i, keys_down_ + i + 1, keys_down_count_ - i);
+      break;
+    }
+  }
+
+  // Keys pressed while the list was full are not in it, so go find them.
+  // This only happens after rolling over.
+  if (keys_down_total_ > keys_down_count_)
+    rebuildKeysDown();
+}
+
+void PS2KeyboardManager::rebuildKeysDown() {
+  for (PS2Keyboard::KeyCode kc = PS2Keyboard::KC_FIRST_NON_MODIFIER_KEYCODE;
+       kc < PS2Keyboard::KC_COUNT_NON_MODIFIER_KEYCODE &&
+           keys_down_count_ < kMaxKeysDown;
+       kc = static_cast<PS2Keyboard::KeyCode>(kc + 1)) {
+    if (isKeyPressed(kc) &&
+        !memchr(keys_down_, kc, keys_down_count_)) {
+      keys_down_[keys_down_count_++] = kc;
+    }
+  }
+}
+
+void PS2KeyboardManager::clearKeys() {
+  memset(pressed_, 0, sizeof(pressed_));
+  keys_down_count_ = 0;
+  keys_down_total_ = 0;
+  repeat_key_ = PS2Keyboard::KC_NO_EVENT;
+  dirty_ = true;
+}
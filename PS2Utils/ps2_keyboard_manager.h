@@ -31,7 +31,9 @@ class PS2KeyboardManager {
     LED_CAPS_LOCK = 1 << 2
   };
 
-  // Information required for a USB HID keyboard report.
+  // Information required for a USB HID keyboard report.  The fields up to
+  // |keycodes| are laid out as the 8 byte boot protocol report, so data() can
+  // be handed to the USB stack as is.
   struct Report {
     Report();
     Report(const Report& other);
@@ -43,8 +45,58 @@ class PS2KeyboardManager {
     bool isGuiPressed();
     bool isKeyPressed(PS2Keyboard::KeyCode keycode);
 
+    // The boot protocol report, kSize bytes long.
+    static const int kSize = 8;
+    const byte* data() const { return &modifiers; }
+
     byte modifiers;
+    byte reserved;
     byte keycodes[6];
+
+#if PS2_TIMESTAMPS
+    // Time in microseconds, as returned by micros(), when the key event that
+    // produced this report was received, or zero for a periodic report.
+    unsigned long timestamp;
+#endif
+  };
+
+  // Information required for an N-key rollover USB HID keyboard report,
+  // returned by readNkro().  Instead of a list of keys, there is one bit for
+  // each non-modifier key code, set if the key is pressed.  Key code N is bit
+  // N % 8 of keys[N / 8].  The fields up to |keys| are laid out as the report
+  // is sent, so data() can be handed to the USB stack as is.  The report
+  // descriptor should declare kKeyBits one bit fields after the modifiers.
+  struct NkroReport {
+    NkroReport();
+
+    bool isKeyPressed(PS2Keyboard::KeyCode keycode);
+
+    static const int kKeyBits = PS2Keyboard::KC_COUNT_NON_MODIFIER_KEYCODE;
+    static const int kKeyBytes = (kKeyBits + 7) / 8;
+
+    // The report, kSize bytes long.
+    static const int kSize = 1 + kKeyBytes;
+    const byte* data() const { return &modifiers; }
+
+    byte modifiers;
+    byte keys[kKeyBytes];
+
+#if PS2_TIMESTAMPS
+    // See Report::timestamp.
+    unsigned long timestamp;
+#endif
+  };
+
+  // Modes of a key in scan code set 3, see setKeyMode().  The values are the
+  // commands that set the mode.
+  enum KeyMode {
+    // Only the make code is sent, repeated while the key is held down.
+    KEY_MODE_TYPEMATIC = 0xFB,
+    // The make code is sent when the key is pressed, and the break code when
+    // it is released.
+    KEY_MODE_MAKE_BREAK = 0xFC,
+    // Only the make code is sent, once.
+    KEY_MODE_MAKE = 0xFD
   };
 
   PS2KeyboardManager();
@@ -78,9 +130,45 @@ class PS2KeyboardManager {
   // in begin().
   int available();
 
-  // Get the inforation required for building a USB HID report.
+  // Returns the current time in milliseconds, see setClock().
+  typedef unsigned long (*Clock)();
+
+  // Sets the polling interval of the USB host in milliseconds, usually 1 or
+  // 8.  When not zero, available() returns at most one report per interval:
+  // a key event is reported right away if no report was read during the
+  // current interval, and otherwise held until the next one.  Each report
+  // then carries all the key events that arrived meanwhile, as with
+  // setCoalesceKeys().  Zero by default, which reports each key event as
+  // soon as it arrives.
+  void setPollInterval(int interval) { poll_interval_ = interval; }
+
+  // Sets the clock used for the poll interval and for periodic reports.
+  // Defaults to millis(), tests may provide their own.
+  void setClock(Clock clock) { clock_ = clock; }
+
+  // Get the inforation required for building a USB HID report.  Normally
+  // each call applies one key event, see setCoalesceKeys().
   Report read();
 
+  // Same as read(), but for an N-key rollover report, which never rolls over
+  // no matter how many keys are pressed.  A sketch should use either read()
+  // or readNkro(), not both.
+  NkroReport readNkro();
+
+  // When enabled, read() applies all pending key events and returns a single
+  // report with the result, so that a burst of keys costs one report instead
+  // of one per key.  To not lose a key that is pressed and released within
+  // the burst, read() stops before the second event for the same key, which
+  // is left for the next report.  In this mode available() returns an upper
+  // bound on the number of reports.  Disabled by default.
+  void setCoalesceKeys(bool enable) { coalesce_keys_ = enable; }
+
+  // Returns true if the report returned by the last call to read() differs
+  // from the one before it, apart from its timestamp.  Periodic reports and
+  // keys that do not change the state of the keyboard, such as typematic
+  // repeats, give the same report again, which need not be sent to the host.
+  bool reportChanged() const { return report_changed_; }
+
   // Determines whether the corresponding modifier key is currently held down
   // or not.
   bool isShiftPressed();
@@ -98,9 +186,47 @@ class PS2KeyboardManager {
   // http://www.computer-engineering.org/ps2keyboard/
   void setTypematicRateAndDelay(byte arg);
 
+  // Repeats held keys in software instead of relying on the keyboard, which
+  // sends the full make code of the key for every repeat.  The last pressed
+  // non-modifier key is repeated |delay| milliseconds after it is pressed and
+  // then every |period| milliseconds, using the clock given to setClock().
+  // Repeats reach transformKey() and the reports the same way as repeats
+  // sent by the keyboard, so like them they leave reportChanged() false.
+  //
+  // Set 2 keyboards can't turn off their own repeats, so they are slowed down
+  // to the minimum of 2 per second after 1 second.  In set 3 all keys are
+  // made make/break instead, which also undoes setKeyMode().  Use a |delay|
+  // of zero to go back to the keyboard's repeats at its default rate.
+  // The commands are sent without waiting, see setLEDs().  Returns false,
+  // leaving the repeats as they were, if the commands could not be queued.
+  bool setSoftwareTypematic(unsigned int delay, unsigned int period);
+
+  // Switches the keyboard to scan code |set|, and the PS2Keyboard to decoding
+  // it.  The keyboard is then asked which set it uses, and false is returned
+  // if it is not |set|, for example because set 3 is not supported.  Keys
+  // received before the call are dropped.  In set 3, all keys are made
+  // typematic/make/break, or make/break with setSoftwareTypematic().
+  //
+  // Set 3 is the most compact: each key has a one-byte make code, there are
+  // no 0xE0 prefixes, and keys can be set to only send the codes needed with
+  // setKeyMode().  This function waits for the keyboard, so it is normally
+  // called from setup() after resetKeyboard(), which goes back to set 2.
+  bool selectScanCodeSet(PS2Keyboard::ScanCodeSet set);
+
+  // Sets the mode of the key |keycode| in scan code set 3.  Returns false if
+  // set 3 is not selected or if |keycode| has no set 3 make code.  Keys with
+  // no break code are released once reported, as with the Pause key, and
+  // must not be modifiers.  PS2Keyboard::setRepeatFilter() should not be
+  // used with them.  Waits for the keyboard, see selectScanCodeSet().
+  bool setKeyMode(PS2Keyboard::KeyCode keycode, KeyMode mode);
+
   // Turns on or off the LEDs on the keyboard.  Both |mask| and |leds| should
   // be the bitwise OR of one or LED_xxx values.  |mask| specifies which LEDs
   // to change, and |leds| specifies their new values.
+  //
+  // This function does not wait for the keyboard.  The LEDs are sent by
+  // available() once the keyboard is not busy with an earlier command, so
+  // several quick changes result in a single command with the last state.
   void setLEDs(byte mask, byte leds);
   byte getLEDs() { return leds_; }
 
@@ -116,11 +242,39 @@ class PS2KeyboardManager {
   // transformation is performed.
   virtual PS2Keyboard::Key transformKey(PS2Keyboard::Key key);
 
-  void processKey(PS2Keyboard::Key key);
+  // Applies pending key events for the next report.  Returns the time of
+  // the first one, see Report::timestamp.
+  unsigned long applyKeys();
+
+  // Applies |key|, as returned by transformKey() for the key |raw_code|.
+  // Software repeats are of |raw_code|, see setSoftwareTypematic().
+  void processKey(PS2Keyboard::Key key, byte raw_code);
   void collectKeysDown(Report* report);
 
-  // Time that available() last returned true.
+  // Sends |leds_| to the keyboard if they changed and nothing is being sent.
+  void syncLEDs();
+
+  // Returns true if software typematic should repeat |repeat_key_| now.
+  bool repeatDue();
+
+  // Workaround for keys with no break code, such as the Pause key, called
+  // once a report with them pressed is built.
+  void releaseNoBreakKeys();
+  void resetKeyModes();
+
+  // Does the work of selectScanCodeSet().
+  bool negotiateScanCodeSet(PS2Keyboard::ScanCodeSet set);
+
+  // Maintain |keys_down_| as non-modifier keys are pressed and released.
+  void addKeyDown(byte keycode);
+  void removeKeyDown(byte keycode);
+  void rebuildKeysDown();
+  void clearKeys();
+
+  // Time that read() last returned a report, according to |clock_|.
   unsigned long last_report_;
+  Clock clock_;
+  int poll_interval_;
 
   PS2Keyboard* ps2_keyboard_;
   PS2Debug* debug_;
@@ -134,8 +288,41 @@ class PS2KeyboardManager {
   static const int kMaskSize = 256 / 8;
   byte pressed_[kMaskSize];
 
-  // State of the keyboard LEDs.
+  // Non-modifier keys currently pressed, in the order they were pressed, so
+  // that reports can be built without scanning |pressed_|.  Only the first
+  // kMaxKeysDown keys are listed, |keys_down_total_| counts all of them.
+  static const byte kMaxKeysDown = 6;
+  byte keys_down_[kMaxKeysDown];
+  byte keys_down_count_;
+  byte keys_down_total_;
+
+  // Non-modifier keys that have no break code, see setKeyMode().  Includes
+  // the Pause key, except in scan code set 3.
+  byte no_break_[NkroReport::kKeyBytes];
+
+  // Last report built by read().  |dirty_| is set when a key changes state in
+  // |pressed_|, and the next report is then marked changed and |report_| is
+  // rebuilt.
+  Report report_;
+  bool dirty_;
+  bool report_changed_;
+  bool report_stale_;
+
+  // State of the keyboard LEDs, whether it still needs to be sent, and
+  // whether the command is queued and its status not checked yet.
   byte leds_;
+  bool leds_changed_;
+  bool leds_sent_;
+
+  bool coalesce_keys_;
+
+  // Software typematic, see setSoftwareTypematic().  |repeat_key_| is the key
+  // to repeat as received, before transformKey(), or KC_NO_EVENT, and
+  // |repeat_next_| the time of its next repeat.
+  unsigned int repeat_delay_;
+  unsigned int repeat_period_;
+  byte repeat_key_;
+  unsigned long repeat_next_;
 };
 
 #endif  // PS2_KEYBOARD_MANAGER_H_
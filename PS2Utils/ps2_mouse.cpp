@@ -0,0 +1,263 @@
+
+#include "ps2_mouse.h"
+
+#include "ps2_debug.h"
+#include "ps2_protocol.h"
+
+// Bit of the first byte of each packet that is always set.
+static const byte kSyncBit = 0x08;
+
+// Returns |value| limited to the range of a signed value whose largest value
+// is |limit|.
+static long saturate(long value, long limit) {
+  if (value > limit)
+    return limit;
+  if (value < -limit - 1)
+    return -limit - 1;
+  return value;
+}
+
+const int PS2Mouse::kBufferSize;
+
+PS2Mouse::Event::Event() : x(0), y(0), wheel(0), buttons(0) {
+#if PS2_TIMESTAMPS
+  timestamp = 0;
+#endif
+}
+
+PS2Mouse::PS2Mouse()
+    : ps2_protocol_(0),
+      debug_(0),
+      has_motion_(false),
+      mouse_type_(MOUSE_STANDARD),
+      packet_size_(0),
+      timestamp_(0),
+      acks_expected_(0),
+      sync_errors_(0) {
+}
+
+PS2Mouse::~PS2Mouse() {
+  end();
+}
+
+bool PS2Mouse::begin(PS2Protocol* ps2_protocol, PS2Debug* debug) {
+  if (!ps2_protocol)
+    return false;
+
+  ps2_protocol_ = ps2_protocol;
+  debug_ = debug;
+  return true;
+}
+
+int PS2Mouse::available() {
+  processBytes();
+  return buffered();
+}
+
+PS2Mouse::Event PS2Mouse::read() {
+  if (buffer_.available() > 0)
+    return buffer_.read();
+
+  has_motion_ = false;
+  return motion_;
+}
+
+const PS2Mouse::Event& PS2Mouse::peek() const {
+  if (buffer_.available() > 0)
+    return buffer_.peek();
+  return motion_;
+}
+
+int PS2Mouse::decodeBytes(int max_bytes) {
+  if (!ps2_protocol_)
+    return 0;
+
+  int count = ps2_protocol_->available();
+  if (count > max_bytes)
+    count = max_bytes;
+
+  // A command that failed gets no more ACKs.  The ACKs already received are
+  // still dropped before the count is cleared.
+  PS2Protocol::WriteStatus status = ps2_protocol_->writeStatus();
+  bool write_failed = acks_expected_ > 0 &&
+      (status == PS2Protocol::WRITE_TIMEOUT ||
+       status == PS2Protocol::WRITE_ERROR);
+
+  for (int i = 0; i < count; ++i) {
+    byte b = ps2_protocol_->read();
+    processByte(b, ps2_protocol_->lastTimestamp());
+  }
+
+  if (write_failed)
+    acks_expected_ = 0;
+  return count;
+}
+
+PS2Mouse::MouseType PS2Mouse::enableExtensions() {
+  static const byte kWheelRates[] = {200, 100, 80};
+  static const byte kButtonRates[] = {200, 200, 80};
+
+  if (!ps2_protocol_)
+    return MOUSE_STANDARD;
+
+  // Mice without the extensions take the sample rates as usual and keep
+  // reporting ID 0.  Buttons 4 and 5 can only be enabled once the wheel is.
+  int id = knock(kWheelRates);
+  if (id == MOUSE_WHEEL && knock(kButtonRates) == MOUSE_FIVE_BUTTONS)
+    id = MOUSE_FIVE_BUTTONS;
+
+  if (id < 0 && debug_)
+    debug_->ErrorHandler(F("No response to mouse ID"));
+
+  MouseType type = MOUSE_STANDARD;
+  if (id == MOUSE_WHEEL || id == MOUSE_FIVE_BUTTONS)
+    type = (MouseType)id;
+  setMouseType(type);
+  return type;
+}
+
+void PS2Mouse::setMouseType(MouseType type) {
+  mouse_type_ = type;
+  packet_size_ = 0;
+}
+
+void PS2Mouse::expectAcks(byte count) {
+  processBytes();
+  packet_size_ = 0;
+  acks_expected_ = count;
+}
+
+void PS2Mouse::end() {
+  ps2_protocol_ = 0;
+  debug_ = 0;
+  buffer_.clear();
+  motion_ = Event();
+  has_motion_ = false;
+  mouse_type_ = MOUSE_STANDARD;
+  packet_size_ = 0;
+  timestamp_ = 0;
+  acks_expected_ = 0;
+  sync_errors_ = 0;
+}
+
+void PS2Mouse::processByteForTesting(byte b, byte timestamp) {
+  processByte(b, timestamp);
+}
+
+void PS2Mouse::handleError(const __FlashStringHelper* error) {
+  if (error && debug_)
+    debug_->ErrorHandler(error);
+}
+
+void PS2Mouse::processBytes() {
+  if (ps2_protocol_)
+    decodeBytes(ps2_protocol_->available());
+}
+
+void PS2Mouse::processByte(byte b, byte timestamp) {
+  // ACKs only come between packets, since the mouse abandons a partial
+  // packet when the command starts.  Inside a packet 0xFA is a movement.
+  if (acks_expected_ > 0 && b == 0xFA && packet_size_ == 0) {
+    --acks_expected_;
+    return;
+  }
+
+  // A packet happens when its first byte arrives.
+  if (packet_size_ == 0)
+    timestamp_ = timestamp;
+  packet_[packet_size_++] = b;
+
+  // A packet can't start with a byte that does not have the sync bit set,
+  // which happens when a byte of the previous packet was lost.
+  if (!(packet_[0] & kSyncBit)) {
+    realign(timestamp);
+    return;
+  }
+
+  byte size = mouse_type_ == MOUSE_STANDARD ? 3 : 4;
+  if (packet_size_ < size)
+    return;
+
+  // The top two bits of the last byte of five button packets are always
+  // zero, which catches more lost bytes.
+  if (mouse_type_ == MOUSE_FIVE_BUTTONS && (packet_[3] & 0xC0)) {
+    realign(timestamp);
+    return;
+  }
+
+  packet_size_ = 0;
+  processPacket();
+}
+
+void PS2Mouse::realign(byte timestamp) {
+  ++sync_errors_;
+  handleError(F("Mouse packet out of sync"));
+
+  // Keep the bytes from the next one that can start a packet.
+  byte start = 1;
+  while (start < packet_size_ && !(packet_[start] & kSyncBit))
+    ++start;
+  packet_size_ -= start;
+  memmove(packet_, packet_ + start, packet_size_);
+  timestamp_ = timestamp;
+}
+
+void PS2Mouse::processPacket() {
+  // The X and Y movements are 9 bit two's complement values, with the sign
+  // bits in the first byte.  The overflow bits are ignored, since the
+  // movement is still the closest value available.
+  byte flags = packet_[0];
+  int x = packet_[1] - ((flags & 0x10) ? 256 : 0);
+  int y = packet_[2] - ((flags & 0x20) ? 256 : 0);
+  byte buttons = flags & (BUTTON_LEFT | BUTTON_RIGHT | BUTTON_MIDDLE);
+  int wheel = 0;
+
+  switch (mouse_type_) {
+    case MOUSE_WHEEL:
+      wheel = (int8_t)packet_[3];
+      break;
+    case MOUSE_FIVE_BUTTONS: {
+      // A 4 bit two's complement wheel movement, followed by buttons 4 and 5.
+      byte extra = packet_[3];
+      wheel = (extra & 0x0F) - ((extra & 0x08) ? 16 : 0);
+      if (extra & 0x10)
+        buttons |= BUTTON_4;
+      if (extra & 0x20)
+        buttons |= BUTTON_5;
+      break;
+    }
+  }
+
+  addMotion(x, y, wheel, buttons);
+}
+
+void PS2Mouse::addMotion(int x, int y, int wheel, byte buttons) {
+  // A change of buttons starts a new event, so that clicks are not merged
+  // away.  If there is no room for the event, the change is merged anyway.
+  if (has_motion_ && buttons != motion_.buttons) {
+    if (buffer_.write(motion_)) {
+      has_motion_ = false;
+    } else {
+      handleError(F("Mouse buffer overflow"));
+    }
+  }
+
+  if (!has_motion_) {
+    motion_ = Event();
+#if PS2_TIMESTAMPS
+    motion_.timestamp = timestamp_;
+#endif
+    has_motion_ = true;
+  }
+
+  motion_.x = saturate((long)motion_.x + x, 32767);
+  motion_.y = saturate((long)motion_.y + y, 32767);
+  motion_.wheel = saturate((long)motion_.wheel + wheel, 127);
+  motion_.buttons = buttons;
+}
+
+int PS2Mouse::knock(const byte* rates) {
+  // Each byte responds with ACK (0xFA), and 0xF2 is followed by the ID.
+  byte command[] = {0xF3, rates[0], 0xF3, rates[1], 0xF3, rates[2], 0xF2};
+  return ps2_protocol_->command(command, sizeof(command));
+}
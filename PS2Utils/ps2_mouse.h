@@ -0,0 +1,198 @@
+#ifndef PS2_MOUSE_H_
+#define PS2_MOUSE_H_
+
+#include <Arduino.h>
+
+#include "ps2_ring_buffer.h"
+#include "ps2_timestamp.h"
+
+// Number of events buffered by each PS2Mouse object, see kBufferSize below.
+// This may be defined in the build flags to size the buffer for a given
+// board.  It must be a power of two no larger than 128, see PS2RingBuffer.
+#ifndef PS2MS_BUFFER_SIZE
+#define PS2MS_BUFFER_SIZE 8
+#endif
+
+class PS2Debug;
+class PS2Protocol;
+
+/**
+ * Class to decode the movement packets sent by a PS2 mouse.  Standard mice
+ * send 3 byte packets with the X and Y movement and three buttons.  Mice that
+ * support the IntelliMouse extensions, enabled with enableExtensions(), send 4
+ * byte packets that add a scroll wheel and, for some, buttons 4 and 5.
+ *
+ * This class must be connected to a PS2Protocol object which handles all the
+ * low level communication with the actual mouse.  Bytes are read from the
+ * PS2Protocol object and assembled into packets.  Packets that only move the
+ * mouse are merged together until they are read, so that a sketch that reads
+ * the mouse less often than it sends packets gets the total movement in one
+ * event.  A new event starts each time the buttons change.
+ */
+class PS2Mouse {
+ public:
+  // Bits of Event::buttons.  The values match the bits of USB HID mouse
+  // reports.
+  enum Button {
+    BUTTON_LEFT = 1 << 0,
+    BUTTON_RIGHT = 1 << 1,
+    BUTTON_MIDDLE = 1 << 2,
+    BUTTON_4 = 1 << 3,
+    BUTTON_5 = 1 << 4
+  };
+
+  // Kinds of mice, which decide the format of the packets.  The values are
+  // the device IDs returned by the mouse in response to the 0xF2 command.
+  enum MouseType {
+    MOUSE_STANDARD = 0x00,  // Three buttons, 3 byte packets
+    MOUSE_WHEEL = 0x03,  // Scroll wheel, 4 byte packets
+    MOUSE_FIVE_BUTTONS = 0x04  // Scroll wheel and five buttons, 4 byte packets
+  };
+
+  // Return value of read().  Holds the movement since the previous event and
+  // the buttons held down.  As sent by the mouse, |y| is positive when the
+  // mouse moves away from the user and |wheel| is positive when the wheel
+  // turns towards the user.  Movement that does not fit is saturated.
+  //
+  // With PS2_TIMESTAMPS enabled, the event also holds the PS2Timestamp of the
+  // first byte of its first packet.
+  struct Event {
+    Event();
+
+    int16_t x;
+    int16_t y;
+    int8_t wheel;
+    byte buttons;
+#if PS2_TIMESTAMPS
+    byte timestamp;
+#endif
+  };
+
+  // Number of events that can be buffered by PS2Mouse.  Movement is merged,
+  // so only button changes need room in the buffer.  If the buffer is full,
+  // the button change is merged too, with errors reported to the error
+  // handler.
+  const static int kBufferSize = PS2MS_BUFFER_SIZE;
+
+  PS2Mouse();
+  ~PS2Mouse();
+
+  // Initialize the PS2 mouse object.  This is normally called once from the
+  // setup() function.  |ps2_protocol| will be used to read the bytes to
+  // be decoded.  It is assumed |ps2_protocol| has already been initialized
+  // (i.e. its begin() method has already been called).
+  //
+  // Returns true if the PS2 mouse object is initialized correctly, and false
+  // otherwise.
+  bool begin(PS2Protocol* ps2_protocol, PS2Debug* debug=0);
+
+  // Returns the number of events available for reading.
+  int available();
+
+  // Reads the next available event.  Should only be called if available()
+  // returns greater than zero.
+  Event read();
+
+  // Returns the next available event without removing it.  Should only be
+  // called if available() returns greater than zero.  Movement received
+  // later may still be merged into it.
+  const Event& peek() const;
+
+  // Decodes at most |max_bytes| of the bytes received from the mouse and
+  // returns how many were decoded.  available() decodes all of them, this
+  // lets a sketch bound the time spent on each of several devices, see
+  // PS2Hub.
+  int decodeBytes(int max_bytes);
+
+  // Returns the number of events available for reading, without decoding any
+  // more bytes.
+  int buffered() const { return buffer_.available() + (has_motion_ ? 1 : 0); }
+
+  // Asks the mouse for the IntelliMouse extensions with the sample rate
+  // sequences 200, 100, 80 and then 200, 200, 80, and selects the packet
+  // format of the extensions the mouse reports.  Each command is waited for,
+  // so this is normally called from setup(), after the mouse is reset and
+  // before data reporting is enabled (0xF4 command).  The sample rate is left
+  // at 80 per second.  Returns the type of the mouse.
+  MouseType enableExtensions();
+
+  // Selects the packet format to decode.  This does not change the format
+  // sent by the mouse, see enableExtensions().  MOUSE_STANDARD by default.
+  void setMouseType(MouseType type);
+  MouseType getMouseType() const { return (MouseType)mouse_type_; }
+
+  // Drops the next |count| ACKs (0xFA) received from the mouse between
+  // packets instead of decoding them.  Called before writing commands to a
+  // mouse that is reporting, since its ACKs would otherwise be taken for the
+  // start of a packet.  Bytes already received are decoded first, and a
+  // partial packet is dropped, since the mouse abandons it when the host
+  // starts sending.  If a write fails, the ACKs still expected are
+  // forgotten, since the bytes not sent get none.
+  void expectAcks(byte count);
+
+  // Number of times since begin() that bytes were dropped because they did
+  // not form a valid packet, usually because a byte was lost.  Decoding then
+  // starts over with the next byte that can start a packet.
+  uint16_t getSyncErrors() const { return sync_errors_; }
+
+  // Disable the PS2 mouse object.  The PS2Protocol given to begin() can now
+  // be used for other purposes.
+  void end();
+
+  // Get the PS2 protocol object associated with this mouse.
+  PS2Protocol* protocol() { return ps2_protocol_; }
+
+  // This is used for testing the PS2Mouse class.  Does not need to be called
+  // in regular programs.
+  void processByteForTesting(byte b, byte timestamp=0);
+
+ private:
+  // Reads as many bytes as possible from the PS2 protocol object, merging
+  // the packets into |motion_| and the buffer.
+  void processBytes();
+  void processByte(byte b, byte timestamp);
+
+  // Drops the bytes of |packet_| up to the next one that can start a packet.
+  // |timestamp| is the timestamp of the last byte received.
+  void realign(byte timestamp);
+
+  // Decodes the complete packet in |packet_|.
+  void processPacket();
+
+  // Adds the movement of one packet to the events.
+  void addMotion(int x, int y, int wheel, byte buttons);
+
+  // Sends the three sample rates in |rates| for enableExtensions() and
+  // returns the device ID the mouse reports after them, or -1 on failure.
+  int knock(const byte* rates);
+
+  // Handles an error while decoding bytes from the mouse.
+  void handleError(const __FlashStringHelper* error);
+
+  PS2Protocol* ps2_protocol_;
+  PS2Debug* debug_;
+
+  // Events that ended with a change of buttons, oldest first.
+  PS2RingBuffer<Event, kBufferSize> buffer_;
+
+  // Movement merged since the last event, valid if |has_motion_| is true.
+  Event motion_;
+  bool has_motion_;
+
+  // One of the MouseType values, stored as a byte.
+  byte mouse_type_;
+
+  // Packet being assembled, and the number of bytes in it so far.
+  byte packet_[4];
+  byte packet_size_;
+
+  // Timestamp of the first byte of the packet being assembled.
+  byte timestamp_;
+
+  // Number of ACKs still to drop, see expectAcks().
+  byte acks_expected_;
+
+  uint16_t sync_errors_;
+};
+
+#endif  // PS2_MOUSE_H_
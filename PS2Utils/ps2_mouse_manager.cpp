@@ -0,0 +1,258 @@
+
+#include "ps2_mouse_manager.h"
+
+#include "ps2_debug.h"
+#include "ps2_protocol.h"
+
+#define numberof(a) (sizeof(a)/sizeof((a)[0]))
+
+// Time the mouse has to finish its self test after a reset, in milliseconds.
+static const int kSelfTestMillis = 750;
+
+// Length of the windows over which setAdaptiveRate() measures the load, in
+// milliseconds.
+static const unsigned long kAdaptMillis = 1000;
+
+// Sample rates that setAdaptiveRate() steps through.  80 is left out so that
+// stepping down from 200 never sends 200, 100, 80, which would be taken for
+// the request to enable the IntelliMouse extensions.
+static const byte kAdaptiveRates[] = {10, 20, 40, 60, 100, 200};
+
+// Largest movement in a USB report, in either direction.
+static const long kMaxDelta = 127;
+
+// Removes the part of |*delta| that fits in a report and returns it.
+static int8_t takeDelta(long* delta) {
+  long part = *delta;
+  if (part > kMaxDelta)
+    part = kMaxDelta;
+  if (part < -kMaxDelta)
+    part = -kMaxDelta;
+  *delta -= part;
+  return (int8_t)part;
+}
+
+// Returns the number of reports needed for the movement |delta|.
+static int reportsFor(long delta) {
+  if (delta < 0)
+    delta = -delta;
+  return (delta + kMaxDelta - 1) / kMaxDelta;
+}
+
+const int PS2MouseManager::Report::kSize;
+
+PS2MouseManager::Report::Report() : buttons(0), x(0), y(0), wheel(0) {
+#if PS2_TIMESTAMPS
+  timestamp = 0;
+#endif
+}
+
+bool PS2MouseManager::Report::isButtonPressed(PS2Mouse::Button button) const {
+  return (buttons & button) != 0;
+}
+
+PS2MouseManager::PS2MouseManager()
+    : last_report_(0),
+      clock_(millis),
+      poll_interval_(0),
+      ps2_mouse_(0),
+      debug_(0),
+      sample_rate_(100),
+      resolution_(2),
+      max_rate_(0),
+      window_start_(0),
+      peak_backlog_(0),
+      moving_(false),
+      frames_dropped_(0) {
+  clearState();
+}
+
+PS2MouseManager::~PS2MouseManager() {
+  end();
+}
+
+bool PS2MouseManager::begin(PS2Mouse* ps2_mouse, PS2Debug* debug) {
+  if (!ps2_mouse)
+    return false;
+
+  ps2_mouse_ = ps2_mouse;
+  debug_ = debug;
+  return true;
+}
+
+int PS2MouseManager::available() {
+  if (max_rate_ > 0)
+    adaptRate();
+
+  int count = pendingReports() + ps2_mouse_->available();
+  if (count > 0 && poll_interval_ > 0) {
+    // One report per poll interval holds all the movement.
+    unsigned long elapsed = clock_() - last_report_;
+    count = elapsed >= (unsigned long)poll_interval_ ? 1 : 0;
+  }
+  return count;
+}
+
+PS2MouseManager::Report PS2MouseManager::read() {
+  last_report_ = clock_();
+
+  // The rest of a split movement goes out before the next event, which may
+  // change the buttons.
+  Report report;
+  if (pendingReports() == 0 && ps2_mouse_->available() > 0) {
+    PS2Mouse::Event event = ps2_mouse_->read();
+    buttons_ = event.buttons;
+    x_ += event.x;
+    y_ -= event.y;
+    wheel_ -= event.wheel;
+#if PS2_TIMESTAMPS
+    report.timestamp = PS2Timestamp::expand(event.timestamp, micros());
+#endif
+  }
+
+  report.buttons = buttons_;
+  report.x = takeDelta(&x_);
+  report.y = takeDelta(&y_);
+  report.wheel = takeDelta(&wheel_);
+  return report;
+}
+
+bool PS2MouseManager::isButtonPressed(PS2Mouse::Button button) const {
+  return (buttons_ & button) != 0;
+}
+
+bool PS2MouseManager::resetMouse() {
+  PS2Protocol* protocol = ps2_mouse_->protocol();
+  clearState();
+  sample_rate_ = 100;
+  resolution_ = 2;
+
+  // Responds with ACK (0xFA), then 0xAA once the self test passes, followed
+  // by the ID of the mouse (0x00).
+  byte reset = 0xFF;
+  if (protocol->command(&reset, 1, kSelfTestMillis) != 0xAA) {
+    if (debug_)
+      debug_->ErrorHandler(F("Mouse self test failed"));
+    return false;
+  }
+  protocol->readResponse();
+
+  // The extensions leave the sample rate at 80, so put back the default,
+  // then enable data reporting.  Each byte responds with ACK (0xFA), which
+  // the mouse drops as they arrive.
+  ps2_mouse_->enableExtensions();
+  ps2_mouse_->expectAcks(3);
+  return protocol->writeAndWait(0xF3) &&
+      protocol->writeAndWait(sample_rate_) &&
+      protocol->writeAndWait(0xF4);
+}
+
+bool PS2MouseManager::setSampleRate(byte rate) {
+  if (!sendCommand(0xF3, rate))
+    return false;
+
+  sample_rate_ = rate;
+  return true;
+}
+
+bool PS2MouseManager::setResolution(byte resolution) {
+  if (!sendCommand(0xE8, resolution))
+    return false;
+
+  resolution_ = resolution;
+  return true;
+}
+
+void PS2MouseManager::setAdaptiveRate(byte max_rate) {
+  max_rate_ = max_rate;
+  window_start_ = clock_();
+  peak_backlog_ = 0;
+  moving_ = false;
+  frames_dropped_ = ps2_mouse_->protocol()->getFramesDropped();
+}
+
+void PS2MouseManager::end() {
+  last_report_ = 0;
+  ps2_mouse_ = 0;
+  debug_ = 0;
+  clearState();
+  max_rate_ = 0;
+}
+
+int PS2MouseManager::pendingReports() const {
+  int count = reportsFor(x_);
+  int y = reportsFor(y_);
+  int wheel = reportsFor(wheel_);
+  if (y > count)
+    count = y;
+  if (wheel > count)
+    count = wheel;
+  return count;
+}
+
+void PS2MouseManager::adaptRate() {
+  // The bytes waiting are measured before the mouse reads them.
+  PS2Protocol* protocol = ps2_mouse_->protocol();
+  int backlog = protocol->available();
+  if (backlog > 0)
+    moving_ = true;
+  if (backlog > peak_backlog_)
+    peak_backlog_ = backlog;
+
+  unsigned long now = clock_();
+  if (now - window_start_ < kAdaptMillis || protocol->writePending() > 0)
+    return;
+
+  uint16_t dropped = protocol->getFramesDropped();
+  bool overrun = dropped != frames_dropped_ ||
+      peak_backlog_ > PS2Protocol::kBufferSize / 2;
+
+  if (overrun) {
+    // Next lower rate.
+    for (int i = numberof(kAdaptiveRates) - 1; i >= 0; --i) {
+      if (kAdaptiveRates[i] < sample_rate_) {
+        setSampleRate(kAdaptiveRates[i]);
+        break;
+      }
+    }
+  } else if (moving_) {
+    // Next higher rate, if allowed.
+    for (int i = 0; i < numberof(kAdaptiveRates); ++i) {
+      if (kAdaptiveRates[i] > sample_rate_) {
+        if (kAdaptiveRates[i] <= max_rate_)
+          setSampleRate(kAdaptiveRates[i]);
+        break;
+      }
+    }
+  }
+
+  window_start_ = now;
+  peak_backlog_ = 0;
+  moving_ = false;
+  frames_dropped_ = dropped;
+}
+
+bool PS2MouseManager::sendCommand(byte command, byte arg) {
+  // Waiting for earlier writes to complete keeps at most one command in
+  // flight.  Reporting is disabled first so that no packet is sent between
+  // the ACKs, and all bytes are queued together.  Each byte responds with
+  // ACK (0xFA).
+  PS2Protocol* protocol = ps2_mouse_->protocol();
+  if (!protocol || protocol->writePending() > 0)
+    return false;
+
+  byte bytes[] = {0xF5, command, arg, 0xF4};
+  ps2_mouse_->expectAcks(numberof(bytes));
+  if (!protocol->write(bytes, numberof(bytes))) {
+    ps2_mouse_->expectAcks(0);
+    return false;
+  }
+  return true;
+}
+
+void PS2MouseManager::clearState() {
+  buttons_ = 0;
+  x_ = 0;
+  y_ = 0;
+  wheel_ = 0;
+}
@@ -0,0 +1,168 @@
+#ifndef PS2_MOUSE_MANAGER_H_
+#define PS2_MOUSE_MANAGER_H_
+
+#include "ps2_mouse.h"
+
+class PS2Debug;
+
+/**
+ * This class manages a PS2 mouse.  It resets the mouse, tracks its buttons,
+ * and produces USB HID mouse reports to ease the implementation of a USB
+ * mouse using an arduino.  The sample rate and resolution of the mouse can be
+ * changed while it is in use, and the sample rate can follow the load the
+ * sketch is able to handle, see setAdaptiveRate().
+ */
+class PS2MouseManager {
+ public:
+  // Information required for a USB HID mouse report.  The fields up to
+  // |wheel| are laid out as the boot protocol report followed by the wheel,
+  // so data() can be handed to the USB stack as is.  Unlike the PS2Mouse
+  // events, |y| is positive when the mouse moves towards the user and
+  // |wheel| is positive when the wheel turns away from the user, as USB
+  // expects.
+  struct Report {
+    Report();
+
+    bool isButtonPressed(PS2Mouse::Button button) const;
+
+    // The report, kSize bytes long.
+    static const int kSize = 4;
+    const byte* data() const { return &buttons; }
+
+    byte buttons;
+    int8_t x;
+    int8_t y;
+    int8_t wheel;
+
+#if PS2_TIMESTAMPS
+    // Time in microseconds, as returned by micros(), when the first packet of
+    // the movement in this report was received, or zero for the rest of a
+    // movement that was split across reports.
+    unsigned long timestamp;
+#endif
+  };
+
+  PS2MouseManager();
+  ~PS2MouseManager();
+
+  // Initialize the PS2MouseManager object.  This is normally called once
+  // from the setup() function, followed by resetMouse().
+  //
+  // |ps2_mouse| will be used to receive events from the PS2 mouse.  It is
+  // assumed |ps2_mouse| has already been initialized (i.e. its begin() method
+  // has already been called).
+  //
+  // Returns true if the object is initialized correctly, and false otherwise.
+  bool begin(PS2Mouse* ps2_mouse, PS2Debug* debug=0);
+
+  // Returns the number of reports available for reading.  Movements larger
+  // than a report can hold are split across several reports, so that no
+  // movement is lost.
+  int available();
+
+  // Returns the current time in milliseconds, see setClock().
+  typedef unsigned long (*Clock)();
+
+  // Sets the polling interval of the USB host in milliseconds, usually 1 or
+  // 8.  When not zero, available() returns at most one report per interval,
+  // and the movement that arrives meanwhile is merged into the next report.
+  // Button changes are never merged, each one gets a report of its own.
+  // Zero by default, which reports each event as soon as it arrives.
+  void setPollInterval(int interval) { poll_interval_ = interval; }
+
+  // Sets the clock used for the poll interval and for setAdaptiveRate().
+  // Defaults to millis(), tests may provide their own.
+  void setClock(Clock clock) { clock_ = clock; }
+
+  // Get the information required for building a USB HID report.
+  Report read();
+
+  // Determines whether the corresponding button is currently held down or
+  // not, as of the last report.
+  bool isButtonPressed(PS2Mouse::Button button) const;
+
+  // Does a power-on reset of the mouse, enables the IntelliMouse extensions
+  // and then data reporting.  This function waits for the mouse, so it is
+  // normally called from setup().  Returns false if the mouse does not pass
+  // its self test.
+  bool resetMouse();
+
+  // Sets the sample rate of the mouse, in packets per second: 10, 20, 40,
+  // 60, 80, 100 or 200.  100 after resetMouse().  The sequences 200, 100, 80
+  // and 200, 200, 80 enable the IntelliMouse extensions and should be
+  // avoided.
+  //
+  // Like setResolution(), this function does not wait for the mouse, and is
+  // meant for a mouse that is reporting.  Data reporting is disabled around
+  // the command, so the ACKs are not mistaken for packets.  Returns false if
+  // an earlier command is still being sent.
+  bool setSampleRate(byte rate);
+  byte getSampleRate() const { return sample_rate_; }
+
+  // Sets the resolution of the mouse, from 0 to 3 for 1, 2, 4 or 8 counts
+  // per millimeter.  2 after resetMouse().  A higher resolution makes the
+  // pointer move further for the same movement of the mouse.  See
+  // setSampleRate().
+  bool setResolution(byte resolution);
+  byte getResolution() const { return resolution_; }
+
+  // Adjusts the sample rate to what the sketch keeps up with, up to
+  // |max_rate|.  Once a second, if the mouse was moving and the PS2Protocol
+  // buffer never got more than half full, the rate is raised one step, and
+  // if it did or bytes were dropped, the rate is lowered one step.  The steps
+  // are the rates of setSampleRate() except 80.  Use zero, the default, to
+  // keep the rate fixed.
+  void setAdaptiveRate(byte max_rate);
+
+  // Shuts down this PS2MouseManager.  The PS2Mouse given to begin() can now
+  // be used for other purposes.
+  void end();
+
+  // Get the PS2 mouse object associated with this manager.
+  PS2Mouse* mouse() { return ps2_mouse_; }
+
+ private:
+  // Returns the number of reports needed for the movement left over from
+  // the last report.
+  int pendingReports() const;
+
+  // Moves the sample rate one step up or down if due, see setAdaptiveRate().
+  void adaptRate();
+
+  // Sends the one byte argument command |command| with reporting disabled.
+  bool sendCommand(byte command, byte arg);
+
+  // Forgets the buttons and the movement left over.
+  void clearState();
+
+  // Time that read() last returned a report, according to |clock_|.
+  unsigned long last_report_;
+  Clock clock_;
+  int poll_interval_;
+
+  PS2Mouse* ps2_mouse_;
+  PS2Debug* debug_;
+
+  // Buttons of the last report, and the movement that did not fit in it, as
+  // reported to USB.
+  byte buttons_;
+  long x_;
+  long y_;
+  long wheel_;
+
+  byte sample_rate_;
+  byte resolution_;
+
+  // Adaptive sample rate, see setAdaptiveRate().  The load is measured over
+  // windows that start at |window_start_|.  |peak_backlog_| is the most
+  // bytes seen waiting in the PS2Protocol buffer, |moving_| is set if any
+  // were, and |frames_dropped_| is PS2Protocol::getFramesDropped() at the
+  // start of the window.
+  byte max_rate_;
+  unsigned long window_start_;
+  int peak_backlog_;
+  bool moving_;
+  uint16_t frames_dropped_;
+};
+
+#endif  // PS2_MOUSE_MANAGER_H_
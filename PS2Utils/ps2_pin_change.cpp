@@ -0,0 +1,82 @@
+
+#include "ps2_pin_change.h"
+
+#if PS2_PIN_CHANGE
+
+#include "ps2_protocol.h"
+
+const int PS2PinChange::kMaxGroups;
+
+PS2PinChange::Group PS2PinChange::groups_[kMaxGroups];
+bool PS2PinChange::enabled_ = false;
+
+bool PS2PinChange::attach(uint8_t clock_pin, PS2Protocol* protocol) {
+  volatile uint8_t* pcicr = digitalPinToPCICR(clock_pin);
+  uint8_t group_index = digitalPinToPCICRbit(clock_pin);
+  if (!enabled_ || !pcicr || group_index >= kMaxGroups || !protocol)
+    return false;
+
+  Group& group = groups_[group_index];
+  volatile uint8_t* input = portInputRegister(digitalPinToPort(clock_pin));
+  uint8_t mask = digitalPinToBitMask(clock_pin);
+  uint8_t bit = portBit(clock_pin);
+
+  // The ISR handler reads one port per group, which is not enough on boards
+  // where a group spans several ports.
+  if (group.mask && group.input != input)
+    return false;
+  if (group.protocols[bit] && group.protocols[bit] != protocol)
+    return false;
+
+  // The level of the pin is sampled now, so that an edge from before the
+  // pin was attached is not taken for a clock pulse.
+  noInterrupts();
+  group.input = input;
+  group.protocols[bit] = protocol;
+  group.mask |= mask;
+  group.previous = (group.previous & ~mask) | (*input & mask);
+  *digitalPinToPCMSK(clock_pin) |= 1 << digitalPinToPCMSKbit(clock_pin);
+  *pcicr |= 1 << group_index;
+  interrupts();
+  return true;
+}
+
+void PS2PinChange::detach(uint8_t clock_pin) {
+  volatile uint8_t* pcicr = digitalPinToPCICR(clock_pin);
+  uint8_t group_index = digitalPinToPCICRbit(clock_pin);
+  if (!pcicr || group_index >= kMaxGroups)
+    return;
+
+  Group& group = groups_[group_index];
+  noInterrupts();
+  *digitalPinToPCMSK(clock_pin) &= ~(1 << digitalPinToPCMSKbit(clock_pin));
+  group.mask &= ~digitalPinToBitMask(clock_pin);
+  group.protocols[portBit(clock_pin)] = 0;
+  if (!group.mask)
+    *pcicr &= ~(1 << group_index);
+  interrupts();
+}
+
+void PS2PinChange::isrHandler(uint8_t group_index) {
+  Group& group = groups_[group_index];
+  uint8_t now = *group.input;
+  uint8_t falling = group.previous & ~now & group.mask;
+  group.previous = now;
+
+  for (uint8_t bit = 0; falling; ++bit, falling >>= 1) {
+    if (falling & 1)
+      group.protocols[bit]->isrHandlerImpl();
+  }
+}
+
+uint8_t PS2PinChange::portBit(uint8_t clock_pin) {
+  uint8_t mask = digitalPinToBitMask(clock_pin);
+  uint8_t bit = 0;
+  while (mask > 1) {
+    mask >>= 1;
+    ++bit;
+  }
+  return bit;
+}
+
+#endif  // PS2_PIN_CHANGE
@@ -0,0 +1,126 @@
+#ifndef PS2_PIN_CHANGE_H_
+#define PS2_PIN_CHANGE_H_
+
+#include <Arduino.h>
+
+// Set to 1 on boards with pin change interrupts, see PS2PinChange.  May be
+// defined to 0 in the build flags to leave out the backend altogether.
+#ifndef PS2_PIN_CHANGE
+#if defined(digitalPinToPCICR)
+#define PS2_PIN_CHANGE 1
+#else
+#define PS2_PIN_CHANGE 0
+#endif
+#endif
+
+#if PS2_PIN_CHANGE
+
+class PS2Protocol;
+
+/**
+ * Pin change interrupt backend for PS2Protocol, used for clock pins that do
+ * not have an external interrupt.  An Uno has only two external interrupts,
+ * but every pin can raise a pin change interrupt.
+ *
+ * Pins are grouped, each group of up to 8 pins sharing one interrupt vector.
+ * The ISR handler of a group reads the port of its clock pins once, finds the
+ * clock pins that went from HIGH to LOW since the last interrupt by comparing
+ * with the previous reading, and calls the ISR handler of the PS2Protocol
+ * object of each one.  Changes of the other pins of the group are ignored,
+ * so the data pins may share the port.
+ *
+ * The backend is off unless the sketch defines the pin change interrupt
+ * vectors with the PS2_PIN_CHANGE_VECTORS() macro, at global scope:
+ *
+ *     #include <ps2_pin_change.h>
+ *
+ *     PS2_PIN_CHANGE_VECTORS();
+ *
+ * This way sketches that use another library that needs the vectors, such
+ * as SoftwareSerial, still link, as long as their clock pins have external
+ * interrupts.  Once the vectors are defined, PS2Protocol::begin() uses this
+ * class on its own, sketches do not need to call it.
+ */
+class PS2PinChange {
+ public:
+  // Number of pin change groups handled, PCINT0 to PCINT2.
+  const static int kMaxGroups = 3;
+
+  // Routes the falling edges of |clock_pin| to |protocol|.  Returns false if
+  // the vectors are not defined, if the pin has no pin change interrupt, if
+  // another protocol uses it, or if the pins of its group already in use are
+  // on another port.
+  static bool attach(uint8_t clock_pin, PS2Protocol* protocol);
+
+  // Stops routing the edges of |clock_pin|.
+  static void detach(uint8_t clock_pin);
+
+  // Shared ISR handler of pin change group |group|.  Called from the
+  // PCINTn_vect interrupt vectors, and by tests.
+  static void isrHandler(uint8_t group);
+
+  // Enables the backend.  Done by PS2_PIN_CHANGE_VECTORS() before setup()
+  // runs.
+  struct Enabler {
+    Enabler() { enabled_ = true; }
+  };
+
+ private:
+  struct Group {
+    // Input register of the port of the clock pins, the clock pins attached
+    // and the level of those pins at the last interrupt.
+    volatile uint8_t* input;
+    uint8_t mask;
+    uint8_t previous;
+
+    // PS2Protocol object of each bit of the port.
+    PS2Protocol* protocols[8];
+  };
+
+  // Returns the bit of the port of |clock_pin|, from 0 to 7.
+  static uint8_t portBit(uint8_t clock_pin);
+
+  static Group groups_[kMaxGroups];
+  static bool enabled_;
+};
+
+#if defined(PCINT0_vect)
+#define PS2_PIN_CHANGE_VECTOR0 \
+    ISR(PCINT0_vect) { PS2PinChange::isrHandler(0); }
+#else
+#define PS2_PIN_CHANGE_VECTOR0
+#endif
+
+#if defined(PCINT1_vect)
+#define PS2_PIN_CHANGE_VECTOR1 \
+    ISR(PCINT1_vect) { PS2PinChange::isrHandler(1); }
+#else
+#define PS2_PIN_CHANGE_VECTOR1
+#endif
+
+#if defined(PCINT2_vect)
+#define PS2_PIN_CHANGE_VECTOR2 \
+    ISR(PCINT2_vect) { PS2PinChange::isrHandler(2); }
+#else
+#define PS2_PIN_CHANGE_VECTOR2
+#endif
+
+// Defines the pin change interrupt vectors of the board, and enables
+// PS2PinChange.  See the class comment.
+#define PS2_PIN_CHANGE_VECTORS()                  \
+    PS2_PIN_CHANGE_VECTOR0                        \
+    PS2_PIN_CHANGE_VECTOR1                        \
+    PS2_PIN_CHANGE_VECTOR2                        \
+    static PS2PinChange::Enabler ps2_pin_change_enabler
+
+#else  // PS2_PIN_CHANGE
+
+// Does nothing on boards without pin change interrupts, where clock pins need
+// an external interrupt.  Expands to a declaration so that the semicolon
+// after the macro is still allowed.
+#define PS2_PIN_CHANGE_VECTORS() \
+    static_assert(true, "No pin change interrupts on this board")
+
+#endif  // PS2_PIN_CHANGE
+
+#endif  // PS2_PIN_CHANGE_H_
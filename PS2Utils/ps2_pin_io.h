@@ -0,0 +1,88 @@
+#ifndef PS2_PIN_IO_H_
+#define PS2_PIN_IO_H_
+
+#include <Arduino.h>
+
+/**
+ * Pin I/O policies used by the PS2Protocol ISR handler.  A policy is bound to
+ * one pin with begin(), normally called from setup(), and then provides
+ * read(), write(), setInputPullup() and setOutput() for that pin.
+ *
+ * PS2PortPin resolves the pin to its port registers and bit mask once in
+ * begin(), so that each access from the ISR handler is a single masked
+ * register operation instead of the pin table lookups done by digitalRead()
+ * and digitalWrite().  The writes are read-modify-write operations on the
+ * port registers, so they must be done with interrupts disabled, as is the
+ * case in an ISR handler.
+ *
+ * PS2DigitalPin uses the regular Arduino functions and works on any board.
+ *
+ * By default PS2PortPin is used on AVR boards and in the unit tests, and
+ * PS2DigitalPin on other boards.  Define PS2_PIN_IO in the build flags to the
+ * name of a class with the same methods to use a different policy.
+ */
+class PS2PortPin {
+ public:
+  PS2PortPin() : input_(0), output_(0), mode_(0), mask_(0) {}
+
+  void begin(uint8_t pin) {
+    uint8_t port = digitalPinToPort(pin);
+    input_ = portInputRegister(port);
+    output_ = portOutputRegister(port);
+    mode_ = portModeRegister(port);
+    mask_ = digitalPinToBitMask(pin);
+  }
+
+  int read() const { return (*input_ & mask_) ? HIGH : LOW; }
+
+  void write(int value) {
+    if (value) {
+      *output_ |= mask_;
+    } else {
+      *output_ &= ~mask_;
+    }
+  }
+
+  void setInputPullup() {
+    *mode_ &= ~mask_;
+    *output_ |= mask_;
+  }
+
+  void setOutput() { *mode_ |= mask_; }
+
+ private:
+  volatile uint8_t* input_;
+  volatile uint8_t* output_;
+  volatile uint8_t* mode_;
+  uint8_t mask_;
+};
+
+class PS2DigitalPin {
+ public:
+  PS2DigitalPin() : pin_(NOT_A_PIN) {}
+
+  void begin(uint8_t pin) { pin_ = pin; }
+
+  int read() const { return digitalRead(pin_); }
+
+  void write(int value) { digitalWrite(pin_, value); }
+
+  void setInputPullup() { pinMode(pin_, INPUT_PULLUP); }
+
+  void setOutput() { pinMode(pin_, OUTPUT); }
+
+ private:
+  uint8_t pin_;
+};
+
+#ifndef PS2_PIN_IO
+#if defined(__AVR__) || !defined(ARDUINO)
+#define PS2_PIN_IO PS2PortPin
+#else
+#define PS2_PIN_IO PS2DigitalPin
+#endif
+#endif
+
+typedef PS2_PIN_IO PS2PinIO;
+
+#endif  // PS2_PIN_IO_H_
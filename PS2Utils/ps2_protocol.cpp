@@ -2,24 +2,73 @@
 #include "ps2_protocol.h"
 
 #include "ps2_debug.h"
+#include "ps2_pin_change.h"
 
 // A bit of a hack to change states.
 #define NEXT_STATE(s) \
       static_cast<State>(static_cast<int>(s) + 1)
 
-const int PS2Protocol::kBufferSize = PS2Protocol::kBufferArraySize - 1;
+const int PS2Protocol::kBufferSize;
+const int PS2Protocol::kWriteBufferSize;
+const int PS2Protocol::kMaxInterrupts;
+const int PS2Protocol::kResponseMillis;
+
+PS2Protocol* PS2Protocol::isr_table_[kMaxInterrupts];
+
+template <int Isr>
+void PS2Protocol::isrTrampoline() {
+  isr_table_[Isr]->isrHandlerImpl();
+}
+
+template <>
+PS2Protocol::IsrHandler PS2Protocol::trampoline<PS2Protocol::kMaxInterrupts>(
+    int) {
+  return 0;
+}
+
+template <int Isr>
+PS2Protocol::IsrHandler PS2Protocol::trampoline(int isr) {
+  return isr == Isr ? isrTrampoline<Isr> : trampoline<Isr + 1>(isr);
+}
+
+PS2Protocol::PS2Protocol() : PS2Protocol(static_cast<IsrHandler>(0)) {
+}
 
 PS2Protocol::PS2Protocol(IsrHandler isr_handler)
     : clock_pulses_(0),
       isr_handler_(isr_handler),
+      isr_bound_(false),
       debug_(0),
       clock_pin_(NOT_A_PIN),
       data_pin_(NOT_A_PIN),
-      head_(0),
-      tail_(0),
+      pin_change_(false),
       state_(WAIT_R_START),
       current_(0),
-      parity_(HIGH) {
+      parity_(HIGH),
+      frame_(0),
+      last_bit_micros_(0),
+      write_result_(WRITE_IDLE),
+      write_phase_(WP_IDLE),
+      write_phase_start_(0),
+      write_status_(WRITE_IDLE),
+      write_callback_(0),
+      write_context_(0),
+      frame_callback_(0),
+      frame_context_(0),
+      resend_on_error_(false),
+      resend_requested_(false),
+      recovering_(false),
+      awaiting_response_(false),
+      device_resend_(false),
+      rx_resends_(0),
+      tx_resends_(0),
+      frames_recovered_(0),
+      frames_dropped_(0),
+      bytes_resent_(0),
+      resyncs_(0) {
+#if PS2_TIMESTAMPS
+  last_timestamp_ = 0;
+#endif
 }
 
 PS2Protocol::~PS2Protocol() {
@@ -30,93 +79,364 @@ bool PS2Protocol::begin(uint8_t clock_pin, uint8_t data_pin, PS2Debug* debug) {
   if (clock_pin == data_pin)
     return false;
 
-  int isr = digitalPinToInterrupt(clock_pin);
-  if (isr == NOT_AN_INTERRUPT)
+  if (clock_pin_ != NOT_A_PIN || data_pin_ != NOT_A_PIN)
     return false;
 
-  if (clock_pin_ != NOT_A_PIN || data_pin_ != NOT_A_PIN)
+  // Pins without an external interrupt fall back to a pin change interrupt.
+  pin_change_ = digitalPinToInterrupt(clock_pin) == NOT_AN_INTERRUPT;
+#if !PS2_PIN_CHANGE
+  if (pin_change_)
     return false;
+#endif
+
+  // Instances without a handler of their own get the one of their interrupt.
+  if (!pin_change_ && !isr_handler_ &&
+      !bindIsrHandler(digitalPinToInterrupt(clock_pin))) {
+    return false;
+  }
 
   clock_pin_ = clock_pin;
   data_pin_ = data_pin;
+  data_io_.begin(data_pin_);
   pinMode(clock_pin_, INPUT_PULLUP);
   pinMode(data_pin_, INPUT_PULLUP);
-  attachInterrupt(isr, isr_handler_, FALLING);
+  if (!attachClock()) {
+    clock_pin_ = NOT_A_PIN;
+    data_pin_ = NOT_A_PIN;
+    return false;
+  }
 
   debug_ = debug;
   return true;
 }
 
 int PS2Protocol::available() {
-  int count = (head_ - tail_ + kBufferArraySize) % kBufferArraySize;
+  poll();
+
+  int count = buffer_.available();
   if (debug_)
     debug_->recordProtocolAvailable(count);
   return count;
 }
 
 byte PS2Protocol::read() {
-  // Extract the byte at |tail_| before incrementing it to prevent races.
-  byte b = buffer_[tail_];
-  tail_  = (tail_ + 1) % kBufferArraySize;
-  return b;
+#if PS2_TIMESTAMPS
+  last_timestamp_ = timestamps_.read();
+#endif
+  return buffer_.read();
+}
+
+bool PS2Protocol::write(byte b) {
+  return write(&b, 1);
+}
+
+bool PS2Protocol::write(const byte* bytes, int count) {
+  if (clock_pin_ == NOT_A_PIN || count > write_buffer_.space())
+    return false;
+
+  for (int i = 0; i < count; ++i)
+    write_buffer_.write(bytes[i]);
+
+  if (write_phase_ == WP_IDLE && count > 0)
+    startRequestToSend();
+  return true;
+}
+
+bool PS2Protocol::writeAndWait(byte b) {
+  if (!write(b))
+    return false;
+
+  // Wait until the byte has been sent and then return.  poll() enforces the
+  // device deadlines, so this loop always terminates.
+  while (writeStatus() == WRITE_PENDING) {
+    delayMicroseconds(kRequestToSendMicros / 2);
+    poll();
+  }
+
+  return writeStatus() == WRITE_DONE;
+}
+
+int PS2Protocol::command(const byte* bytes, int count, int millis) {
+  while (available() > 0)
+    read();
+
+  for (int i = 0; i < count; ++i) {
+    if (!writeAndWait(bytes[i]))
+      return -1;
+  }
+  return readResponse(millis);
+}
+
+int PS2Protocol::readResponse(int millis) {
+  for (int i = 0; i <= millis; ++i) {
+    while (available() > 0) {
+      byte b = read();
+      if (b != 0xFA)
+        return b;
+    }
+    delay(1);
+  }
+  return -1;
+}
+
+int PS2Protocol::writePending() {
+  return write_buffer_.available();
 }
 
-void PS2Protocol::write(byte b) {
+PS2Protocol::WriteStatus PS2Protocol::writeStatus() {
+  return write_phase_ == WP_IDLE ? write_status_ : WRITE_PENDING;
+}
+
+void PS2Protocol::setWriteCallback(WriteCallback callback, void* context) {
+  write_callback_ = callback;
+  write_context_ = context;
+}
+
+void PS2Protocol::setFrameCallback(FrameCallback callback, void* context) {
+  // Both are changed together so that the ISR handler never calls the new
+  // callback with the old context.
+  noInterrupts();
+  frame_callback_ = callback;
+  frame_context_ = context;
+  interrupts();
+}
+
+void PS2Protocol::setResendOnError(bool enable) {
+  resend_on_error_ = enable;
+}
+
+void PS2Protocol::poll() {
+  switch (write_phase_) {
+    case WP_IDLE:
+      break;
+    case WP_REQUEST_TO_SEND:
+      if (micros() - write_phase_start_ < kRequestToSendMicros)
+        break;
+
+      // At this point, the PS2 device will have detected the request-to-send
+      // and will stop generating the clock.  The member variables normally
+      // touched only by the ISR can be set.
+      state_ = WAIT_S_DATA0;
+      current_ = write_buffer_.peek();
+      parity_ = HIGH;
+      write_result_ = WRITE_PENDING;
+      write_phase_ = WP_SENDING;
+      write_phase_start_ = micros();
+      attachClock();
+
+      // Now relese the clock so that the device can start generating it again.
+      pinMode(clock_pin_, INPUT_PULLUP);
+      break;
+    case WP_SENDING: {
+      // The ISR handler may complete the byte at any moment, so interrupts
+      // are disabled while checking the deadlines.
+      noInterrupts();
+      WriteStatus status = write_result_;
+      if (status == WRITE_PENDING) {
+        unsigned long elapsed = micros() - write_phase_start_;
+        bool started = state_ != WAIT_S_DATA0;
+        if ((!started && elapsed > kStartDeadlineMicros) ||
+            elapsed > kStartDeadlineMicros + kTransferDeadlineMicros) {
+          releaseLines();
+          status = WRITE_TIMEOUT;
+        }
+      }
+      interrupts();
+
+      if (status == WRITE_TIMEOUT && debug_)
+        debug_->ErrorHandler(F("Write timeout"));
+
+      if (status == WRITE_DONE && resend_on_error_) {
+        // Wait for the device to answer, in case it asks for the byte again.
+        write_phase_ = WP_WAIT_RESPONSE;
+        write_phase_start_ = micros();
+      } else if (status != WRITE_PENDING) {
+        finishWrite(status);
+      }
+      break;
+    }
+    case WP_WAIT_RESPONSE:
+      if (device_resend_) {
+        device_resend_ = false;
+        if (tx_resends_ < kMaxResends) {
+          ++tx_resends_;
+          ++bytes_resent_;
+          startRequestToSend();
+        } else {
+          finishWrite(WRITE_ERROR);
+        }
+      } else if (!awaiting_response_ || resend_requested_) {
+        // Any other answer, even a bad frame, means the byte was accepted.
+        finishWrite(WRITE_DONE);
+      } else if (micros() - write_phase_start_ > kResponseDeadlineMicros) {
+        awaiting_response_ = false;
+        if (debug_)
+          debug_->ErrorHandler(F("No response"));
+        finishWrite(WRITE_TIMEOUT);
+      }
+      break;
+  }
+
+  if (resend_requested_ && write_phase_ == WP_IDLE)
+    requestResend();
+}
+
+void PS2Protocol::requestResend() {
+  resend_requested_ = false;
+
+  // Consecutive bad frames are asked for again a few times before the byte
+  // is given up on.
+  if (!recovering_)
+    rx_resends_ = 0;
+
+  bool requested = rx_resends_ < kMaxResends && write(kResendCommand);
+
+  // The ISR handler also updates these.
+  noInterrupts();
+  if (requested) {
+    ++rx_resends_;
+    recovering_ = true;
+  } else {
+    recovering_ = false;
+    ++frames_dropped_;
+  }
+  interrupts();
+}
+
+void PS2Protocol::startRequestToSend() {
   // Acquire the clock and data lines and put them into "request-to-send" state.
   // This means holding the clock and data low for 100usec, then releasing the
-  // clock.
+  // clock.  poll() releases the clock once the 100usec have elapsed.
   //
   // Interrupts are detached while setting the clock and data lines so that
   // a spurious interrupt is not geneated by the lowering clock line.
   // Without this PS2Procotol, which is likely in the state WAIT_R_START,
   // will generates an "invalid start bit" error as the clock falls.
-  detachInterrupt(digitalPinToInterrupt(clock_pin_));
+  detachClock();
   pinMode(clock_pin_, OUTPUT);
   pinMode(data_pin_, OUTPUT);
   digitalWrite(clock_pin_, LOW);
   digitalWrite(data_pin_, LOW);
-  delayMicroseconds(100);
-  attachInterrupt(digitalPinToInterrupt(clock_pin_), isr_handler_, FALLING);
+  write_phase_ = WP_REQUEST_TO_SEND;
+  write_phase_start_ = micros();
+}
 
-  // At this point, the PS2 device will have detected the request-to-send and
-  // will stop generating the clock.  The member variables normally touched
-  // only by the ISR can be set.
-  state_ = WAIT_S_DATA0;
-  current_ = b;
-  parity_ = HIGH;
+void PS2Protocol::finishWrite(WriteStatus status) {
+  // Bytes are often part of a multi-byte command, so if one fails there is
+  // no point sending the rest.  The dropped bytes are copied out before
+  // calling the callback, since the callback may queue new bytes.
+  byte done[kWriteBufferSize];
+  int count = 0;
+  do {
+    done[count++] = write_buffer_.read();
+  } while (status != WRITE_DONE && write_buffer_.available() > 0);
 
-  // Now relese the clock so that the device can start generating it again.
-  pinMode(clock_pin_, INPUT_PULLUP);
+  write_status_ = status;
+  write_phase_ = WP_IDLE;
+  tx_resends_ = 0;
+
+  // If the re-send request itself could not be sent, the bad frame is lost.
+  noInterrupts();
+  if (status != WRITE_DONE && recovering_) {
+    recovering_ = false;
+    ++frames_dropped_;
+  }
+  interrupts();
+
+  if (write_buffer_.available() > 0)
+    startRequestToSend();
+
+  if (write_callback_) {
+    for (int i = 0; i < count; ++i)
+      write_callback_(write_context_, done[i], status);
+  }
 }
 
-bool PS2Protocol::writeAndWait(byte b) {
-  write(b);
+bool PS2Protocol::bindIsrHandler(int isr) {
+  if (isr < 0 || isr >= kMaxInterrupts || isr_table_[isr])
+    return false;
 
-  // Wait until the byte has been sent and then return.  Ih theory, the device
-  // may take up to 15msec to start generating the clock.  Once started, the
-  // transfer should not take more than 2msec.
-  while (state_ > WAIT_R_IGNORE)
-    delay(6);
+  isr_table_[isr] = this;
+  isr_handler_ = trampoline<0>(isr);
+  isr_bound_ = true;
+  return true;
+}
 
-  // TODO: may want to return false if it took more than 17msec.
-  // TODO: add some histograms to see how long this actually takes.
+void PS2Protocol::unbindIsrHandler() {
+  if (!isr_bound_)
+    return;
+
+  isr_table_[digitalPinToInterrupt(clock_pin_)] = 0;
+  isr_handler_ = 0;
+  isr_bound_ = false;
+}
+
+bool PS2Protocol::attachClock() {
+#if PS2_PIN_CHANGE
+  if (pin_change_)
+    return PS2PinChange::attach(clock_pin_, this);
+#endif
+
+  attachInterrupt(digitalPinToInterrupt(clock_pin_), isr_handler_, FALLING);
   return true;
 }
 
+void PS2Protocol::detachClock() {
+#if PS2_PIN_CHANGE
+  if (pin_change_) {
+    PS2PinChange::detach(clock_pin_);
+    return;
+  }
+#endif
+
+  detachInterrupt(digitalPinToInterrupt(clock_pin_));
+}
+
+void PS2Protocol::releaseLines() {
+  state_ = WAIT_R_START;
+  pinMode(clock_pin_, INPUT_PULLUP);
+  pinMode(data_pin_, INPUT_PULLUP);
+}
+
 void PS2Protocol::end() {
   if (clock_pin_ == NOT_A_PIN)
     return;
 
-  detachInterrupt(digitalPinToInterrupt(clock_pin_));
+  if (write_phase_ != WP_IDLE)
+    releaseLines();
+
+  detachClock();
+  unbindIsrHandler();
   clock_pulses_ = 0;
   debug_ = 0;
   clock_pin_ = NOT_A_PIN;
   data_pin_ = NOT_A_PIN;
-  head_ = 0;
-  tail_ = 0;
+  pin_change_ = false;
+  buffer_.clear();
+#if PS2_TIMESTAMPS
+  timestamps_.clear();
+  last_timestamp_ = 0;
+#endif
   state_ = WAIT_R_START;
   current_ = 0;
   parity_ = HIGH;
+  frame_ = 0;
+  last_bit_micros_ = 0;
+  write_result_ = WRITE_IDLE;
+  write_buffer_.clear();
+  write_phase_ = WP_IDLE;
+  write_phase_start_ = 0;
+  write_status_ = WRITE_IDLE;
+  resend_requested_ = false;
+  recovering_ = false;
+  awaiting_response_ = false;
+  device_resend_ = false;
+  rx_resends_ = 0;
+  tx_resends_ = 0;
+  frames_recovered_ = 0;
+  frames_dropped_ = 0;
+  bytes_resent_ = 0;
+  resyncs_ = 0;
 }
 
 void PS2Protocol::callIsrHandlerForTesting(int bit) {
@@ -131,75 +451,104 @@ void PS2Protocol::isrHandlerImpl() {
   ++clock_pulses_;
 
   if (state_ < WAIT_S_DATA0) {
-    isrHandleReceivedBit(digitalRead(data_pin_));
+    isrHandleReceivedBit(data_io_.read());
   } else {
-    int bit = state_ == WAIT_S_ACK ? digitalRead(data_pin_) : LOW;
+    int bit = state_ == WAIT_S_ACK ? data_io_.read() : LOW;
     isrHandleSendBit(bit);
   }
 }
 
 void PS2Protocol::isrHandleReceivedBit(int bit) {
-  switch(state_) {
-    case WAIT_R_START:
-      // The start bit should always be zero.
-      if (!bit) {
-        state_ = WAIT_R_DATA0;
-        current_ = 0;
-        parity_ = HIGH;
-      } else {
-        handleError(F("Invalid start bit"));
-      }
-      break;
-    case WAIT_R_DATA0:
-    case WAIT_R_DATA1:
-    case WAIT_R_DATA2:
-    case WAIT_R_DATA3:
-    case WAIT_R_DATA4:
-    case WAIT_R_DATA5:
-    case WAIT_R_DATA6:
-    case WAIT_R_DATA7: {
-      current_ >>= 1;
-      if (bit) {
-        current_ |= 0x80;
-        parity_ = parity_ == HIGH ? LOW : HIGH;
-      }
+  // A frame is clocked out without pause, so a long gap since the last bit
+  // means an edge was missed.  Drop the partial frame and take this bit as
+  // the start of a new one.
+  unsigned long now = micros();
+  if (state_ != WAIT_R_START && now - last_bit_micros_ > kMaxBitGapMicros) {
+    ++resyncs_;
+    handleError(F("Timeout between bits"));
+  }
+  last_bit_micros_ = now;
 
-      state_ = NEXT_STATE(state_);
-      break;
+  // The data and parity bits are shifted into |frame_| as they arrive, least
+  // significant bit first, and the frame is only validated once the stop bit
+  // is in.  The start bit is the exception: it is checked right away so that
+  // a glitch on an idle line does not swallow the next real frame.
+  if (state_ == WAIT_R_START) {
+    if (bit) {
+      handleError(F("Invalid start bit"));
+      return;
     }
-    case WAIT_R_PARITY:
-      // Parity is expected to be odd, so the read bit should equal the
-      // accumulated parity.
-      if (bit != parity_) {
-        handleError(F("Invalid parity bit"));
-        break;
-      }
-      state_ = WAIT_R_STOP;
-      break;
-    case WAIT_R_STOP:
-      // The stop bit should always be one.
-      if (bit) {
-        byte new_head = (head_ + 1) % kBufferArraySize;
-        // If the buffer is not full, add the currently accumulated byte.
-        if (new_head != tail_) {
-          buffer_[head_] = current_;
-          head_  = new_head;
-        } else {
-          handleError(F("Protocol buffer overflow"));
-          break;
-        }
-      } else {
-        handleError(F("Invalid stop bit"));
-        break;
-      }
-      state_ = WAIT_R_START;
-      break;
-    case WAIT_R_IGNORE:
-      break;
-    default:
-      handleError(F("Invalid PS2 state"));
-      break;
+    frame_ = 0;
+    state_ = WAIT_R_DATA0;
+    return;
+  }
+
+  if (state_ < WAIT_R_STOP) {
+    frame_ >>= 1;
+    if (bit)
+      frame_ |= kFrameParityBit;
+    state_ = NEXT_STATE(state_);
+    return;
+  }
+
+  if (state_ != WAIT_R_STOP)
+    return;
+
+  // Parity is odd, so the data and parity bits together must have an odd
+  // number of ones.
+  uint16_t frame = frame_;
+  if (!__builtin_parity(frame)) {
+    handleFrameError(F("Invalid parity bit"));
+    return;
+  }
+
+  if (!bit) {
+    handleFrameError(F("Invalid stop bit"));
+    return;
   }
+
+  byte data = (byte)frame;
+  state_ = WAIT_R_START;
+
+  if (recovering_) {
+    recovering_ = false;
+    ++frames_recovered_;
+  }
+
+  // A 0xFE answering a written byte asks for that byte again.  poll()
+  // re-sends it, so it is not given to the reader.
+  if (awaiting_response_) {
+    awaiting_response_ = false;
+    if (data == kResendCommand) {
+      device_resend_ = true;
+      return;
+    }
+  }
+
+  // The byte is either handed over right away, or buffered for read().
+  FrameCallback callback = frame_callback_;
+  if (callback) {
+#if PS2_TIMESTAMPS
+    callback(frame_context_, data, PS2Timestamp::fromMicros(now));
+#else
+    callback(frame_context_, data, 0);
+#endif
+    return;
+  }
+
+  // If the buffer is not full, add the received byte.
+  if (buffer_.full()) {
+    ++frames_dropped_;
+    handleError(F("Protocol buffer overflow"));
+    return;
+  }
+
+#if PS2_TIMESTAMPS
+  // The timestamp goes in first, so that it is there by the time read()
+  // sees the byte.
+  timestamps_.write(PS2Timestamp::fromMicros(now));
+#endif
+  buffer_.write(data);
 }
 
 void PS2Protocol::isrHandleSendBit(int bit) {
@@ -217,16 +566,16 @@ void PS2Protocol::isrHandleSendBit(int bit) {
       if (sbit)
         parity_ = parity_ == HIGH ? LOW : HIGH;
 
-      digitalWrite(data_pin_, sbit);
+      data_io_.write(sbit);
       state_ = NEXT_STATE(state_);
       break;
     }
     case WAIT_S_PARITY:
-      digitalWrite(data_pin_, parity_);
+      data_io_.write(parity_);
       state_ = WAIT_S_STOP;
       break;
     case WAIT_S_STOP:
-      pinMode(data_pin_, INPUT_PULLUP);
+      data_io_.setInputPullup();
       state_ = WAIT_S_ACK;
       break;
     case WAIT_S_ACK:
@@ -236,6 +585,8 @@ void PS2Protocol::isrHandleSendBit(int bit) {
         break;
       }
 
+      awaiting_response_ = resend_on_error_;
+      write_result_ = WRITE_DONE;
       state_ = WAIT_R_START;
       break;
     default:
@@ -248,6 +599,21 @@ void PS2Protocol::handleError(const __FlashStringHelper* error) {
   if (error && debug_)
     debug_->ErrorHandler(error);
 
+  // Errors while sending fail the byte being written.
+  if (state_ > WAIT_R_IGNORE)
+    write_result_ = WRITE_ERROR;
+
   state_ = WAIT_R_START;
-  // TODO: send a "re-send" (0xFE) command to device?
+}
+
+void PS2Protocol::handleFrameError(const __FlashStringHelper* error) {
+  // Sending the re-send command requires the request-to-send delay, which
+  // can't be done from the ISR handler, so leave it for poll().
+  if (resend_on_error_) {
+    resend_requested_ = true;
+  } else {
+    ++frames_dropped_;
+  }
+
+  handleError(error);
 }
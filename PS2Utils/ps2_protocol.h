@@ -3,19 +3,56 @@
 
 #include <Arduino.h>
 
+#include "ps2_pin_io.h"
+#include "ps2_ring_buffer.h"
+#include "ps2_timestamp.h"
+
 // Missing definition in 1.0.6.
 #ifndef NOT_AN_INTERRUPT
 #define NOT_AN_INTERRUPT -1
 #endif
 
+// Number of bytes buffered by each PS2Protocol object, see kBufferSize and
+// kWriteBufferSize below.  These may be defined in the build flags to size
+// the buffers for a given board.  Both must be powers of two no larger
+// than 128, see PS2RingBuffer.
+#ifndef PS2P_BUFFER_SIZE
+#define PS2P_BUFFER_SIZE 16
+#endif
+
+#ifndef PS2P_WRITE_BUFFER_SIZE
+#define PS2P_WRITE_BUFFER_SIZE 8
+#endif
+
+// Number of external interrupts that PS2Protocol objects declared without
+// the macros below can be bound to, see kMaxInterrupts.  This may be defined
+// in the build flags for boards with more external interrupts.
+#ifndef PS2P_MAX_INTERRUPTS
+#define PS2P_MAX_INTERRUPTS 8
+#endif
+
 class PS2Debug;
 
 /**
  * Class to handle low level PS2 keyboard/mouse protocol.
  *
- * Because ISR handlers do not take an argument, it is not possible to support
- * multiple instances of this class without specifying a unique handler for
- * each instance.  To help with this, use the following special macros.
+ * Because ISR handlers do not take an argument, each instance of this class
+ * needs a unique handler.  Instances constructed without arguments are bound
+ * by begin() to the handler of their interrupt number, from a fixed table, so
+ * they can be declared like any other variable, including in arrays.  For
+ * example:
+ *
+ *     #include "ps2_protocol.h"
+ *
+ *     PS2Protocol protocols[2];
+ *
+ *     void setup() {
+ *       protocols[0].begin(2, 4);
+ *       protocols[1].begin(3, 5);
+ *     }
+ *
+ * Alternatively, each instance can be given a handler of its own at compile
+ * time with the following special macros.
  *
  * To declare a global variable of type PS2Protocol use the PS2P_GLOBAL macro.
  * For example:
@@ -65,17 +102,54 @@ class PS2Protocol {
  public:
   // Number of bytes received from PS2 device that will be buffered by
   // PS2Protocol.  If the buffer overflows, newer bytes will be dropped.
-  const static int kBufferSize;
+  const static int kBufferSize = PS2P_BUFFER_SIZE;
+
+  // Number of bytes that can be queued with write() before being sent to the
+  // PS2 device.
+  const static int kWriteBufferSize = PS2P_WRITE_BUFFER_SIZE;
+
+  // Number of external interrupts that instances constructed without an ISR
+  // handler can use.  begin() fails for interrupt numbers beyond that.
+  const static int kMaxInterrupts = PS2P_MAX_INTERRUPTS;
+
+  // Time given to the PS2 device to respond to a command, in milliseconds.
+  const static int kResponseMillis = 20;
+
+  // Status of the bytes sent to the PS2 device with write().
+  enum WriteStatus {
+    WRITE_IDLE,  // Nothing has been written yet
+    WRITE_PENDING,  // Bytes are queued or being sent
+    WRITE_DONE,  // Last byte was sent and acknowledged by the device
+    WRITE_TIMEOUT,  // Device did not clock in the last byte in time
+    WRITE_ERROR  // Device did not acknowledge the last byte
+  };
 
   // An ISR handler for this instance of PS2 protocol.
   typedef void (*IsrHandler)();
 
+  // Called from poll() once for each byte given to write(), when the byte has
+  // either been sent or failed to be sent.  |context| is the value passed to
+  // setWriteCallback().
+  typedef void (*WriteCallback)(void* context, byte b, WriteStatus status);
+
+  // Called from the ISR handler with each byte received from the PS2 device,
+  // when set with setFrameCallback().  |timestamp| is the PS2Timestamp of the
+  // byte, always zero unless PS2_TIMESTAMPS is enabled.
+  typedef void (*FrameCallback)(void* context, byte b, byte timestamp);
+
+  // The ISR handler is bound by begin(), see the class comment.  Only one
+  // instance may use each interrupt.
+  PS2Protocol();
+
   // Normally called via the macros.
   PS2Protocol(IsrHandler isr_handler);
   ~PS2Protocol();
 
   // Initialize the PS2 protocol object.  This is normally called once from the
   // setup() function.  |clock_pin| must be a pin that supports interrupts.
+  // Pins with an external interrupt are used as is, and other pins share a
+  // pin change interrupt if the sketch defines the vectors, see PS2PinChange,
+  // so on an Uno any pin will do.
   // |data_pin| can be any digital pin.
   //
   // Returns true if the PS2 protocol object is initialized correctly, and
@@ -85,24 +159,106 @@ class PS2Protocol {
   // Returns the number of bytes available for reading.
   int available();
 
+  // Returns the number of bytes available for reading, without calling
+  // poll().  Safe to call with interrupts disabled.
+  int buffered() const { return buffer_.available(); }
+
   // Reads the next available byte.  Should only be called if available()
   // returns greated than zero.
   byte read();
 
-  // Sends one byte to the PS2 device.  This function returns immediately and
-  // does not wait for the byte to be sent.
-  void write(byte b);
+  // Returns the PS2Timestamp of the time the byte last returned by read() was
+  // received.  Always zero unless PS2_TIMESTAMPS is enabled.
+  byte lastTimestamp() const {
+#if PS2_TIMESTAMPS
+    return last_timestamp_;
+#else
+    return 0;
+#endif
+  }
+
+  // Queues one byte to be sent to the PS2 device.  This function returns
+  // immediately and does not wait for the byte to be sent.  Queued bytes are
+  // sent in order by the ISR handler, with poll() taking care of the
+  // request-to-send and of the device deadlines.
+  //
+  // Returns false if the write queue is full.
+  bool write(byte b);
+
+  // Queues |count| bytes to be sent to the PS2 device.  Either all the bytes
+  // are queued or none are.  Returns false if the write queue does not have
+  // enough room.
+  bool write(const byte* bytes, int count);
 
   // Similar to the write() method, but waits for the byte to be sent before
-  // returning.
+  // returning.  Returns true if the device acknowledged the byte, and false
+  // if the byte could not be sent.
   bool writeAndWait(byte b);
 
+  // Sends the |count| bytes of a command with writeAndWait(), after dropping
+  // the bytes already received so that they are not taken for its response.
+  // Returns the response, as readResponse() does, or -1 if a byte could not
+  // be sent.
+  int command(const byte* bytes, int count, int millis=kResponseMillis);
+
+  // Returns the next byte received from the PS2 device other than ACK (0xFA),
+  // or -1 if none arrives within |millis| milliseconds.
+  int readResponse(int millis=kResponseMillis);
+
+  // Returns the number of bytes given to write() that are not completely sent.
+  int writePending();
+
+  // Returns WRITE_PENDING while bytes are queued, and otherwise the status of
+  // the last byte sent.  If a byte fails to be sent, all other queued bytes
+  // are dropped with the same status.
+  WriteStatus writeStatus();
+
+  // Registers a function to be called as each written byte completes.  Pass
+  // zero to remove the callback.
+  void setWriteCallback(WriteCallback callback, void* context=0);
+
+  // Registers a function to be called from the ISR handler with each byte as
+  // soon as it is received, instead of buffering it for read().  The function
+  // runs with interrupts disabled, so it must be short.  A 0xFE answering a
+  // written byte is still handled by poll() and not passed on.  Pass zero to
+  // go back to buffering bytes.
+  void setFrameCallback(FrameCallback callback, void* context=0);
+
+  // When enabled, frames received with a bad parity or stop bit are recovered
+  // by asking the device to re-send them (0xFE command), and a written byte is
+  // automatically sent again if the device answers it with 0xFE.  In this
+  // mode each written byte also waits for the device's response before the
+  // next queued byte is sent.  Disabled by default.
+  void setResendOnError(bool enable);
+
+  // Number of bad frames that were recovered by a re-send, and number of
+  // received bytes that were lost, either because of a bad frame that could
+  // not be recovered or because the buffer was full.
+  uint16_t getFramesRecovered() const { return frames_recovered_; }
+  uint16_t getFramesDropped() const { return frames_dropped_; }
+
+  // Number of times a written byte was sent again because the device
+  // answered with 0xFE.
+  uint16_t getBytesResent() const { return bytes_resent_; }
+
+  // Number of times a partial frame was dropped because the device stopped
+  // clocking it for longer than a bit period allows, usually because a clock
+  // edge was missed.  Receiving then starts over with the next bit.
+  uint16_t getResyncs() const { return resyncs_; }
+
+  // Moves queued bytes along to the PS2 device without blocking.  This is
+  // called by available(), but can also be called directly from loop() when
+  // only sending.  The device is given 15msec to start clocking a byte and
+  // 2msec more to finish, otherwise the byte fails with WRITE_TIMEOUT.
+  void poll();
+
   // Disable the PS2 protocol object.  The clock and data pins can now be
   // used for other purposes.
   void end();
 
   // ISR handler.  Not called directly, should only be called from the
-  // PSP2_IMPLEMENT macro.
+  // PSP2_IMPLEMENT macro, from the handlers bound by begin() or from
+  // PS2PinChange.
   void isrHandlerImpl();
 
   // Used only for testing.  |bit| should be either LOW or HIGH only.
@@ -150,7 +306,62 @@ class PS2Protocol {
   uint16_t getClockPulsesForTesting() const { return clock_pulses_; }
 
  private:
-  const static int kBufferArraySize = 17;
+  // Progress of the byte at the front of the write queue.
+  enum WritePhase {
+    WP_IDLE,  // Write queue is empty
+    WP_REQUEST_TO_SEND,  // Clock and data held low to inhibit the device
+    WP_SENDING,  // Clock released, ISR handler is sending bits
+    WP_WAIT_RESPONSE  // Byte sent, waiting for device to answer, if resending
+  };
+
+  // Timing of a host to device transfer, in microseconds.
+  const static unsigned long kRequestToSendMicros = 100;
+  const static unsigned long kStartDeadlineMicros = 15000;
+  const static unsigned long kTransferDeadlineMicros = 2000;
+  const static unsigned long kResponseDeadlineMicros = 20000;
+
+  // Longest time allowed between two bits of a frame sent by the device, in
+  // microseconds.  The PS2 clock runs at 10 to 16.7 kHz, so a bit never takes
+  // more than 100 microseconds.
+  const static unsigned long kMaxBitGapMicros = 250;
+
+  // Command sent by either side to ask for the last byte again, and number of
+  // times in a row a byte is asked for before giving up.
+  const static byte kResendCommand = 0xFE;
+  const static byte kMaxResends = 3;
+
+  // Starts the request-to-send for the byte at the front of the write queue.
+  void startRequestToSend();
+
+  // Removes the byte at the front of the write queue and reports |status|.
+  void finishWrite(WriteStatus status);
+
+  // ISR handlers of instances constructed without one.  isrTrampoline<Isr>()
+  // calls the instance bound to interrupt |Isr| in |isr_table_|, and
+  // trampoline<0>() returns the handler for interrupt |isr|, or zero if
+  // there is none.
+  template <int Isr> static void isrTrampoline();
+  template <int Isr> static IsrHandler trampoline(int isr);
+  static PS2Protocol* isr_table_[kMaxInterrupts];
+
+  // Binds this instance to interrupt |isr| in |isr_table_|, and undoes it.
+  // bindIsrHandler() returns false if the interrupt is out of range or
+  // already bound.
+  bool bindIsrHandler(int isr);
+  void unbindIsrHandler();
+
+  // Enables and disables the interrupt of the clock pin, either an external
+  // interrupt or a pin change interrupt.  attachClock() returns false if the
+  // interrupt can't be used.
+  bool attachClock();
+  void detachClock();
+
+  // Releases the clock and data lines and resumes receiving.
+  void releaseLines();
+
+  // Bit of |frame_| each received data or parity bit is shifted into.  Once
+  // the parity bit is in, the data byte is in the low 8 bits.
+  const static uint16_t kFrameParityBit = 0x100;
 
   // Called from ISR handler when a bit is received from the PS2 device.
   void isrHandleReceivedBit(int bit);
@@ -161,28 +372,41 @@ class PS2Protocol {
   // Handles an error while reading a bytes from the PS2 device.
   void handleError(const __FlashStringHelper* error);
 
+  // Handles a received frame with a bad parity or stop bit.
+  void handleFrameError(const __FlashStringHelper* error);
+
+  // Asks the device to re-send a bad frame.  Called from poll().
+  void requestResend();
+
   // For debugging.  Number of clock pulses since begin().
   volatile uint16_t clock_pulses_;
 
-  // Handlers for this instance of PS2Protocol.
+  // Handlers for this instance of PS2Protocol.  |isr_bound_| is true while
+  // |isr_handler_| comes from bindIsrHandler().
   IsrHandler isr_handler_;
+  bool isr_bound_;
   PS2Debug* volatile debug_;
 
   // Pins used to communicate with PS2 device.
   uint8_t clock_pin_;
   uint8_t data_pin_;
 
-  // Circular buffer holding bytes received from PS2 device. The ISR handler
-  // adds bytes at the head of the buffer, while the read() method removes
-  // bytes from the tail.  Note the following conditions:
-  //
-  //   0 <= head_ < sizeof(buffer_) / sizeof(buffer_[0])
-  //   0 <= tail_ < sizeof(buffer_) / sizeof(buffer_[0])
-  //   head_ == tail_ : the buffer is empty
-  //   head_ + 1 == tail_ : buffer is full
-  volatile byte head_;
-  volatile byte tail_;
-  volatile byte buffer_[kBufferArraySize];
+  // True if the clock pin uses a pin change interrupt instead of an external
+  // interrupt.
+  bool pin_change_;
+
+  // Fast access to the data pin from the ISR handler, resolved in begin().
+  PS2PinIO data_io_;
+
+  // Bytes received from PS2 device.  The ISR handler is the producer and the
+  // read() method is the consumer.
+  PS2RingBuffer<byte, kBufferSize> buffer_;
+
+#if PS2_TIMESTAMPS
+  // Time each byte in |buffer_| was received, in step with |buffer_|.
+  PS2RingBuffer<byte, kBufferSize> timestamps_;
+  byte last_timestamp_;
+#endif
 
   // The following variables are used from within the ISR.  The |state_| and
   // |current_| can be accessed from loop() when sending a byte to the PS2
@@ -190,10 +414,56 @@ class PS2Protocol {
   // the ISR, so there should be no race conditions.
 
   // State of the protocol while comunicating with the PS2 device.  Can be one
-  // of the State values.
+  // of the State values.  |current_| and |parity_| are used while sending,
+  // and |frame_| accumulates the bits received so far.
   volatile State state_;
   volatile byte current_;
   volatile int parity_;
+  volatile uint16_t frame_;
+
+  // Time in microseconds when the last bit was received.
+  volatile unsigned long last_bit_micros_;
+
+  // Result of sending |current_|, set by the ISR handler.  Stays WRITE_PENDING
+  // until the device acknowledges the byte or an error occurs.
+  volatile WriteStatus write_result_;
+
+  // Bytes to send to the PS2 device.  Only accessed from loop(), the ISR
+  // handler only deals with |current_|.
+  PS2RingBuffer<byte, kWriteBufferSize> write_buffer_;
+
+  // State of the byte at the front of the write queue, and the time in
+  // microseconds when that state was entered.
+  WritePhase write_phase_;
+  unsigned long write_phase_start_;
+
+  // Status of the last byte that finished sending.
+  WriteStatus write_status_;
+
+  WriteCallback write_callback_;
+  void* write_context_;
+
+  // Set from loop() and used by the ISR handler, see setFrameCallback().
+  FrameCallback volatile frame_callback_;
+  void* volatile frame_context_;
+
+  // The following variables implement setResendOnError().  The ISR handler
+  // sets |resend_requested_| on a bad frame and |device_resend_| when the
+  // device answers a written byte with 0xFE, poll() acts on them.
+  // |recovering_| is true from the time 0xFE is queued until the next good
+  // frame arrives.
+  bool resend_on_error_;
+  volatile bool resend_requested_;
+  volatile bool recovering_;
+  volatile bool awaiting_response_;
+  volatile bool device_resend_;
+  byte rx_resends_;
+  byte tx_resends_;
+
+  volatile uint16_t frames_recovered_;
+  volatile uint16_t frames_dropped_;
+  uint16_t bytes_resent_;
+  volatile uint16_t resyncs_;
 };
 
 
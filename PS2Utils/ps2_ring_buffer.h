@@ -0,0 +1,158 @@
+#ifndef PS2_RING_BUFFER_H_
+#define PS2_RING_BUFFER_H_
+
+#include <Arduino.h>
+
+// Builds that are not for an Arduino board, such as the unit tests, use the
+// standard library atomics.
+#if !defined(__AVR__) && !defined(ARDUINO)
+#define PS2_RING_USE_STD_ATOMIC 1
+#include <atomic>
+#endif
+
+/**
+ * Index into a PS2RingBuffer that is written by one side of the buffer and
+ * read by the other.  Stores are release operations and loads by the other
+ * side are acquire operations, so that the contents of a slot are visible
+ * before the index that hands it over.
+ *
+ * On AVR, byte loads and stores are atomic and the CPU does not reorder
+ * memory accesses, so only the compiler needs to be kept from moving buffer
+ * accesses across the index.  Other boards (ARM, ESP32) use the GCC atomic
+ * builtins, which emit the required memory barriers.
+ */
+class PS2RingIndex {
+ public:
+  PS2RingIndex() : value_(0) {}
+
+  // Load by the side that owns the index, no ordering required.
+  byte load() const {
+#if defined(PS2_RING_USE_STD_ATOMIC)
+    return value_.load(std::memory_order_relaxed);
+#else
+    return value_;
+#endif
+  }
+
+  // Load by the side that does not own the index.
+  byte loadAcquire() const {
+#if defined(PS2_RING_USE_STD_ATOMIC)
+    return value_.load(std::memory_order_acquire);
+#elif defined(__AVR__)
+    byte value = value_;
+    asm volatile("" ::: "memory");
+    return value;
+#else
+    return __atomic_load_n(&value_, __ATOMIC_ACQUIRE);
+#endif
+  }
+
+  // Store by the side that owns the index.
+  void storeRelease(byte value) {
+#if defined(PS2_RING_USE_STD_ATOMIC)
+    value_.store(value, std::memory_order_release);
+#elif defined(__AVR__)
+    asm volatile("" ::: "memory");
+    value_ = value;
+#else
+    __atomic_store_n(&value_, value, __ATOMIC_RELEASE);
+#endif
+  }
+
+ private:
+  PS2RingIndex(const PS2RingIndex&);
+  PS2RingIndex& operator=(const PS2RingIndex&);
+
+#if defined(PS2_RING_USE_STD_ATOMIC)
+  std::atomic<byte> value_;
+#else
+  volatile byte value_;
+#endif
+};
+
+/**
+ * Lock-free circular buffer with a single producer and a single consumer,
+ * used to pass data between the stages of PS2Utils, for example from an ISR
+ * handler to loop().  The producer only calls write(), full() and space(),
+ * and the consumer only calls available(), peek() and read().  Either side
+ * may run in an ISR handler, but each side must be used from only one
+ * context.
+ *
+ * |Size| must be a power of two no larger than 128.  The head and tail
+ * indices are free running bytes that are masked when accessing the buffer,
+ * so all |Size| slots can be used and no division is needed.
+ */
+template <typename T, int Size>
+class PS2RingBuffer {
+ public:
+  static_assert(Size > 0 && Size <= 128 && (Size & (Size - 1)) == 0,
+                "PS2RingBuffer size must be a power of two, at most 128");
+
+  // Maximum number of elements the buffer can hold.
+  static const int kSize = Size;
+
+  PS2RingBuffer() {}
+
+  // Consumer side.  Returns the number of elements that can be read.
+  int available() const {
+    return (byte)(head_.loadAcquire() - tail_.load());
+  }
+
+  // Consumer side.  Returns the next element without removing it.  Should
+  // only be called if available() returns greater than zero.
+  const T& peek() const {
+    return buffer_[tail_.load() & kMask];
+  }
+
+  // Consumer side.  Removes and returns the next element.  Should only be
+  // called if available() returns greater than zero.
+  T read() {
+    byte tail = tail_.load();
+    T value = buffer_[tail & kMask];
+    tail_.storeRelease(tail + 1);
+    return value;
+  }
+
+  // Producer side.  Returns the number of elements that can be written.
+  int space() const {
+    return Size - (byte)(head_.load() - tail_.loadAcquire());
+  }
+
+  // Producer side.  Returns true if no more elements can be written.
+  bool full() const {
+    return space() == 0;
+  }
+
+  // Producer side.  Adds |value| to the buffer.  Returns false, and drops
+  // |value|, if the buffer is full.
+  bool write(const T& value) {
+    byte head = head_.load();
+    if ((byte)(head - tail_.loadAcquire()) == Size)
+      return false;
+    buffer_[head & kMask] = value;
+    head_.storeRelease(head + 1);
+    return true;
+  }
+
+  // Empties the buffer.  Neither side may be using the buffer at the time,
+  // for example because the ISR handler is detached.
+  void clear() {
+    head_.storeRelease(0);
+    tail_.storeRelease(0);
+  }
+
+ private:
+  static const byte kMask = Size - 1;
+
+  PS2RingBuffer(const PS2RingBuffer&);
+  PS2RingBuffer& operator=(const PS2RingBuffer&);
+
+  PS2RingIndex head_;  // Written by the producer only.
+  PS2RingIndex tail_;  // Written by the consumer only.
+  T buffer_[Size];
+};
+
+template <typename T, int Size>
+const int PS2RingBuffer<T, Size>::kSize;
+
+#endif  // PS2_RING_BUFFER_H_
@@ -0,0 +1,126 @@
+#ifndef PS2_SCAN_CODES_H_
+#define PS2_SCAN_CODES_H_
+
+// Scan codes of all the keys known to PS2Keyboard.  This list is the only
+// place where scan codes are defined: the tables used to decode them, and to
+// find the scan code of a key, are generated from it in ps2_keyboard.cpp.
+//
+// Each line gives the name of the key's PS2Keyboard::KC_xxx value, which is
+// the USB usage of the key, followed by its make code in scan code sets 1, 2
+// and 3.  See http://www.computer-engineering.org/ps2keyboard/ for the three
+// sets.  Lines are in the order of the key codes.
+//
+// Make codes prefixed with 0xE0 are written with the prefix.  Zero means the
+// key has no make code in that set.  The Pause key sends a sequence of its own
+// in sets 1 and 2, which the decoders handle directly.
+//
+// |KEY| is the name of a macro that takes the four values of a line.
+#define PS2_SCAN_CODES(KEY) \
+  KEY(A,                   0x1E,   0x1C, 0x1C) \
+  KEY(B,                   0x30,   0x32, 0x32) \
+  KEY(C,                   0x2E,   0x21, 0x21) \
+  KEY(D,                   0x20,   0x23, 0x23) \
+  KEY(E,                   0x12,   0x24, 0x24) \
+  KEY(F,                   0x21,   0x2B, 0x2B) \
+  KEY(G,                   0x22,   0x34, 0x34) \
+  KEY(H,                   0x23,   0x33, 0x33) \
+  KEY(I,                   0x17,   0x43, 0x43) \
+  KEY(J,                   0x24,   0x3B, 0x3B) \
+  KEY(K,                   0x25,   0x42, 0x42) \
+  KEY(L,                   0x26,   0x4B, 0x4B) \
+  KEY(M,                   0x32,   0x3A, 0x3A) \
+  KEY(N,                   0x31,   0x31, 0x31) \
+  KEY(O,                   0x18,   0x44, 0x44) \
+  KEY(P,                   0x19,   0x4D, 0x4D) \
+  KEY(Q,                   0x10,   0x15, 0x15) \
+  KEY(R,                   0x13,   0x2D, 0x2D) \
+  KEY(S,                   0x1F,   0x1B, 0x1B) \
+  KEY(T,                   0x14,   0x2C, 0x2C) \
+  KEY(U,                   0x16,   0x3C, 0x3C) \
+  KEY(V,                   0x2F,   0x2A, 0x2A) \
+  KEY(W,                   0x11,   0x1D, 0x1D) \
+  KEY(X,                   0x2D,   0x22, 0x22) \
+  KEY(Y,                   0x15,   0x35, 0x35) \
+  KEY(Z,                   0x2C,   0x1A, 0x1A) \
+  KEY(1,                   0x02,   0x16, 0x16) \
+  KEY(2,                   0x03,   0x1E, 0x1E) \
+  KEY(3,                   0x04,   0x26, 0x26) \
+  KEY(4,                   0x05,   0x25, 0x25) \
+  KEY(5,                   0x06,   0x2E, 0x2E) \
+  KEY(6,                   0x07,   0x36, 0x36) \
+  KEY(7,                   0x08,   0x3D, 0x3D) \
+  KEY(8,                   0x09,   0x3E, 0x3E) \
+  KEY(9,                   0x0A,   0x46, 0x46) \
+  KEY(0,                   0x0B,   0x45, 0x45) \
+  KEY(ENTER,               0x1C,   0x5A, 0x5A) \
+  KEY(ESC,                 0x01,   0x76, 0x08) \
+  KEY(BACKSPACE,           0x0E,   0x66, 0x66) \
+  KEY(TAB,                 0x0F,   0x0D, 0x0D) \
+  KEY(SPACE,               0x39,   0x29, 0x29) \
+  KEY(MINUS,               0x0C,   0x4E, 0x4E) \
+  KEY(EQUAL,               0x0D,   0x55, 0x55) \
+  KEY(OPEN_BRACKET,        0x1A,   0x54, 0x54) \
+  KEY(CLOSE_BRACKET,       0x1B,   0x5B, 0x5B) \
+  KEY(BACKSLASH,           0x2B,   0x5D, 0x5C) \
+  KEY(SEMI_COLON,          0x27,   0x4C, 0x4C) \
+  KEY(QUOTE,               0x28,   0x52, 0x52) \
+  KEY(BACK_QUOTE,          0x29,   0x0E, 0x0E) \
+  KEY(COMMA,               0x33,   0x41, 0x41) \
+  KEY(PERIOD,              0x34,   0x49, 0x49) \
+  KEY(SLASH,               0x35,   0x4A, 0x4A) \
+  KEY(CAPS_LOCK,           0x3A,   0x58, 0x14) \
+  KEY(F1,                  0x3B,   0x05, 0x07) \
+  KEY(F2,                  0x3C,   0x06, 0x0F) \
+  KEY(F3,                  0x3D,   0x04, 0x17) \
+  KEY(F4,                  0x3E,   0x0C, 0x1F) \
+  KEY(F5,                  0x3F,   0x03, 0x27) \
+  KEY(F6,                  0x40,   0x0B, 0x2F) \
+  KEY(F7,                  0x41,   0x83, 0x37) \
+  KEY(F8,                  0x42,   0x0A, 0x3F) \
+  KEY(F9,                  0x43,   0x01, 0x47) \
+  KEY(F10,                 0x44,   0x09, 0x4F) \
+  KEY(F11,                 0x57,   0x78, 0x56) \
+  KEY(F12,                 0x58,   0x07, 0x5E) \
+  KEY(PRINT_SCREEN,      0xE037, 0xE07C, 0x57) \
+  KEY(SCROLL_LOCK,         0x46,   0x7E, 0x5F) \
+  KEY(PAUSE,                  0,      0, 0x62) \
+  KEY(INSERT,            0xE052, 0xE070, 0x67) \
+  KEY(HOME,              0xE047, 0xE06C, 0x6E) \
+  KEY(PGUP,              0xE049, 0xE07D, 0x6F) \
+  KEY(DELETE,            0xE053, 0xE071, 0x64) \
+  KEY(END,               0xE04F, 0xE069, 0x65) \
+  KEY(PGDN,              0xE051, 0xE07A, 0x6D) \
+  KEY(RIGHT,             0xE04D, 0xE074, 0x6A) \
+  KEY(LEFT,              0xE04B, 0xE06B, 0x61) \
+  KEY(DOWN,              0xE050, 0xE072, 0x60) \
+  KEY(UP,                0xE048, 0xE075, 0x63) \
+  KEY(KP_NUM_LOCK,         0x45,   0x77, 0x76) \
+  KEY(KP_DIV,            0xE035, 0xE04A, 0x77) \
+  KEY(KP_MULT,             0x37,   0x7C, 0x7E) \
+  KEY(KP_SUB,              0x4A,   0x7B, 0x84) \
+  KEY(KP_ADD,              0x4E,   0x79, 0x7C) \
+  KEY(KP_ENTER,          0xE01C, 0xE05A, 0x79) \
+  KEY(KP_1,                0x4F,   0x69, 0x69) \
+  KEY(KP_2,                0x50,   0x72, 0x72) \
+  KEY(KP_3,                0x51,   0x7A, 0x7A) \
+  KEY(KP_4,                0x4B,   0x6B, 0x6B) \
+  KEY(KP_5,                0x4C,   0x73, 0x73) \
+  KEY(KP_6,                0x4D,   0x74, 0x74) \
+  KEY(KP_7,                0x47,   0x6C, 0x6C) \
+  KEY(KP_8,                0x48,   0x75, 0x75) \
+  KEY(KP_9,                0x49,   0x7D, 0x7D) \
+  KEY(KP_0,                0x52,   0x70, 0x70) \
+  KEY(KP_DOT,              0x53,   0x71, 0x71) \
+  KEY(NON_US_BACKSLASH,    0x56,   0x61, 0x13) \
+  KEY(APPS,              0xE05D, 0xE02F, 0x8D) \
+  KEY(POWER,             0xE05E, 0xE037,    0) \
+  KEY(LCTRL,               0x1D,   0x14, 0x11) \
+  KEY(LSHFT,               0x2A,   0x12, 0x12) \
+  KEY(LALT,                0x38,   0x11, 0x19) \
+  KEY(LGUI,              0xE05B, 0xE01F, 0x8B) \
+  KEY(RCTRL,             0xE01D, 0xE014, 0x58) \
+  KEY(RSHFT,               0x36,   0x59, 0x59) \
+  KEY(RALT,              0xE038, 0xE011, 0x39) \
+  KEY(RGUI,              0xE05C, 0xE027, 0x8C)
+
+#endif  // PS2_SCAN_CODES_H_
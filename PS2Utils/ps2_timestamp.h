@@ -0,0 +1,44 @@
+#ifndef PS2_TIMESTAMP_H_
+#define PS2_TIMESTAMP_H_
+
+#include <Arduino.h>
+
+// Define PS2_TIMESTAMPS to 1 in the build flags to record when each byte is
+// received from the PS2 device.  The time is carried with the received bytes,
+// the decoded keys and the keyboard reports, see PS2Protocol::lastTimestamp(),
+// PS2Keyboard::Key::timestamp() and PS2KeyboardManager::Report::timestamp.
+// Disabled by default, in which case the buffers hold no timestamps.
+#ifndef PS2_TIMESTAMPS
+#define PS2_TIMESTAMPS 0
+#endif
+
+/**
+ * Compact timestamps used while buffering received data.  A timestamp is the
+ * value of micros() in units of 256 microseconds, truncated to one byte, so
+ * that each buffered byte or key only grows by one byte.
+ *
+ * Since the high bits are dropped, a timestamp is really a delta from the
+ * time it is expanded back into a micros() value.  expand() is exact to 256
+ * microseconds as long as it is called within 65 milliseconds of the event,
+ * which is the case when the buffers are emptied from loop().
+ */
+class PS2Timestamp {
+ public:
+  // Returns the timestamp for the time |now|, in microseconds.
+  static byte fromMicros(unsigned long now) {
+    return (byte)(now >> kShift);
+  }
+
+  // Returns the time in microseconds of the timestamp |stamp|, given the
+  // current time |now| in microseconds.
+  static unsigned long expand(byte stamp, unsigned long now) {
+    unsigned long ticks = now >> kShift;
+    byte age = (byte)((byte)ticks - stamp);
+    return (ticks - age) << kShift;
+  }
+
+ private:
+  static const byte kShift = 8;
+};
+
+#endif  // PS2_TIMESTAMP_H_
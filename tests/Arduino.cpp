@@ -3,35 +3,66 @@
 #include "Arduino.h"
 
 #include <algorithm> // for remove_if
-#include <ctime>  // for time()
 #include <functional> // for equal_to
 #include <vector>
 
 namespace {
 
 const int kMaxPins = 32;
+const int kPinsPerPort = 8;
+const int kMaxPorts = kMaxPins / kPinsPerPort;
+
+// Port registers.  The output register is also read as the input register.
+volatile uint8_t g_portMode[kMaxPorts];
+volatile uint8_t g_portOutput[kMaxPorts];
+// Handlers attached to the external interrupts.
+const int kMaxInterrupts = 2;
+void (*g_isr_handlers[kMaxInterrupts])(void);
 
-uint8_t g_pinMode[kMaxPins];
-uint8_t g_pinValue[kMaxPins];
 std::vector<arduino::mock::DelayHook*> g_delay_hooks;
+unsigned long g_micros = 0;
 
 class Init {
  public:
   Init() {
-    memset(g_pinMode, INPUT, sizeof(g_pinMode));
-    memset(g_pinValue, -1, sizeof(g_pinValue));
+    for (int i = 0; i < kMaxPorts; ++i) {
+      g_portMode[i] = 0;
+      g_portOutput[i] = 0;
+    }
   }
 } globalInit;
 
 }  // namespace
 
+volatile uint8_t PCICR = 0;
+volatile uint8_t PCMSK0 = 0;
+volatile uint8_t PCMSK1 = 0;
+volatile uint8_t PCMSK2 = 0;
+
 
 namespace arduino {
 
 namespace mock {
 
 uint8_t GetPinMode(uint8_t pin) {
-  return g_pinMode[pin];
+  uint8_t port = digitalPinToPort(pin);
+  uint8_t mask = digitalPinToBitMask(pin);
+  if (g_portMode[port] & mask)
+    return OUTPUT;
+  return (g_portOutput[port] & mask) ? INPUT_PULLUP : INPUT;
+}
+
+void RaiseInterrupt(uint8_t isr) {
+  if (isr < kMaxInterrupts && g_isr_handlers[isr])
+    g_isr_handlers[isr]();
+}
+
+void AdvanceMicros(unsigned long usec) {
+  g_micros += usec;
+}
+
+void SetMicros(unsigned long usec) {
+  g_micros = usec;
 }
 
 void RegisterDelayHook(DelayHook* delay_hook) {
@@ -56,36 +87,86 @@ void UnregisterAllDelayHooks() {
 
 
 void pinMode(uint8_t pin, uint8_t mode) {
-  g_pinMode[pin] = mode;
+  uint8_t port = digitalPinToPort(pin);
+  uint8_t mask = digitalPinToBitMask(pin);
+  if (mode == OUTPUT) {
+    g_portMode[port] |= mask;
+  } else {
+    g_portMode[port] &= ~mask;
+    if (mode == INPUT_PULLUP) {
+      g_portOutput[port] |= mask;
+    } else {
+      g_portOutput[port] &= ~mask;
+    }
+  }
 }
 
 int digitalRead(uint8_t pin) {
-  return g_pinValue[pin];
+  return (*portInputRegister(digitalPinToPort(pin)) &
+          digitalPinToBitMask(pin)) ? HIGH : LOW;
 }
 
 void digitalWrite(uint8_t pin, uint8_t value) {
-  g_pinValue[pin] = value;
+  uint8_t port = digitalPinToPort(pin);
+  uint8_t mask = digitalPinToBitMask(pin);
+  if (value) {
+    g_portOutput[port] |= mask;
+  } else {
+    g_portOutput[port] &= ~mask;
+  }
+}
+
+uint8_t digitalPinToPort(uint8_t pin) {
+  return pin / kPinsPerPort;
+}
+
+uint8_t digitalPinToBitMask(uint8_t pin) {
+  return 1 << (pin % kPinsPerPort);
+}
+
+volatile uint8_t* portInputRegister(uint8_t port) {
+  return &g_portOutput[port];
+}
+
+volatile uint8_t* portOutputRegister(uint8_t port) {
+  return &g_portOutput[port];
+}
+
+volatile uint8_t* portModeRegister(uint8_t port) {
+  return &g_portMode[port];
 }
 
 void interrupts() {}
 
 void noInterrupts() {}
 
-void attachInterrupt(uint8_t isr, void (*handler)(void), int mode) {}
+void attachInterrupt(uint8_t isr, void (*handler)(void), int mode) {
+  if (isr < kMaxInterrupts)
+    g_isr_handlers[isr] = handler;
+}
 
-void detachInterrupt(uint8_t isr) {}
+void detachInterrupt(uint8_t isr) {
+  if (isr < kMaxInterrupts)
+    g_isr_handlers[isr] = 0;
+}
 
 unsigned long millis() {
-  return time(0);
+  return g_micros / 1000;
+}
+
+unsigned long micros() {
+  return g_micros;
 }
 
 void delay(unsigned int msec) {
+  g_micros += msec * 1000UL;
   for (auto it = g_delay_hooks.begin(); it != g_delay_hooks.end(); ++it) {
     (*it)->RunDelayHook();
   }
 }
 
 void delayMicroseconds(unsigned int usec) {
+  g_micros += usec;
   for (auto it = g_delay_hooks.begin(); it != g_delay_hooks.end(); ++it) {
     (*it)->RunDelayHook();
   }
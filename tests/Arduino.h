@@ -36,23 +36,56 @@ extern "C" {
 
 #define PROGMEM
 #define pgm_read_byte_near(addr) *(addr)
+#define pgm_read_word_near(addr) *(addr)
 typedef short prog_uchar;
 
 typedef unsigned char boolean;
 typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
+typedef signed char int8_t;
+typedef short int16_t;
 typedef uint8_t byte;
 
 void pinMode(uint8_t pin, uint8_t mode);
 int digitalRead(uint8_t pin);
 void digitalWrite(uint8_t pin, uint8_t value);
 
+// Pins are grouped into ports of 8 pins, modeled after AVR.  Each port has a
+// mode register (DDRx), an output register (PORTx) and an input register
+// (PINx).  The input register reads back the output register.
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+volatile uint8_t* portInputRegister(uint8_t port);
+volatile uint8_t* portOutputRegister(uint8_t port);
+volatile uint8_t* portModeRegister(uint8_t port);
+
+// Pin change interrupts, modeled after AVR.  Pins 0 to 23 belong to pin
+// change groups 0 to 2, one group per port, enabled by the bits of PCICR.
+// The pins of each group that raise the interrupt are selected by the bits
+// of its PCMSKn register, in the order of the bits of the port.  Pins 24 and
+// up have no pin change interrupt.  Nothing calls the interrupt vectors, so
+// tests call the ISR handlers after changing the pins.
+extern volatile uint8_t PCICR;
+extern volatile uint8_t PCMSK0;
+extern volatile uint8_t PCMSK1;
+extern volatile uint8_t PCMSK2;
+
+#define digitalPinToPCICR(p) ((p) < 24 ? &PCICR : (volatile uint8_t*)0)
+#define digitalPinToPCICRbit(p) ((p) / 8)
+#define digitalPinToPCMSK(p) \
+    ((p) < 8 ? &PCMSK0 : ((p) < 16 ? &PCMSK1 : \
+                          ((p) < 24 ? &PCMSK2 : (volatile uint8_t*)0)))
+#define digitalPinToPCMSKbit(p) ((p) % 8)
+
 void interrupts();
 void noInterrupts();
 void attachInterrupt(uint8_t isr, void (*handler)(void), int mode);
 void detachInterrupt(uint8_t isr);
 
+// The mock clock starts at zero and only moves forward when delay() or
+// delayMicroseconds() is called.  This makes timeouts deterministic in tests.
 unsigned long millis();
+unsigned long micros();
 void delay(unsigned int msec);
 void delayMicroseconds(unsigned int usec);
 
@@ -67,11 +100,23 @@ namespace arduino {
 
 namespace mock {
 
-// In tests, the last value written by digitalWrite() can be read by
-// digitalRead().  The pin mode is essentually ignored.  Reading a pin that
-// has not been written returns an undefined value.
+// In tests, the last value written by digitalWrite() or through the port
+// registers can be read by digitalRead().  Setting the mode to INPUT_PULLUP
+// makes the pin read HIGH, and INPUT makes it read LOW.  Returns the mode
+// of the pin as last set by pinMode() or through the port registers.
 uint8_t GetPinMode(uint8_t pin);
 
+// Calls the ISR handler attached to external interrupt |isr| with
+// attachInterrupt(), if any, as a falling edge of its pin would.
+void RaiseInterrupt(uint8_t isr);
+
+// Move the mock clock used by millis() and micros().  Unlike delay(), these do
+// not run the delay hooks, so they can be used to space out calls to an ISR
+// handler.  The clock never goes back to zero between tests, so tests should
+// only rely on differences between two readings.
+void AdvanceMicros(unsigned long usec);
+void SetMicros(unsigned long usec);
+
 // Regsister hooks that will be called when either delay() or
 // delayMicroseconds() is called.
 class DelayHook {
@@ -0,0 +1,197 @@
+
+#include <unit_tests.h>
+
+#include "ps2_hub.h"
+#include "ps2_protocol.h"
+#include "ps2_test_device.h"
+
+#define numberof(a) (sizeof(a)/sizeof((a)[0]))
+
+// Set 2 make codes.
+static const byte kMakeA = 0x1C;
+static const byte kMakeB = 0x32;
+
+class PS2HubTests : public testing::TestCase {
+ protected:
+  void SendKey(byte make_code) {
+    SendFrame(&keyboard_protocol_, make_code);
+  }
+
+  void SendPacket(byte flags, byte x, byte y) {
+    SendFrame(&mouse_protocol_, flags);
+    SendFrame(&mouse_protocol_, x);
+    SendFrame(&mouse_protocol_, y);
+  }
+
+  PS2P_DECLARE(PS2HubTests, keyboard_protocol_);
+  PS2P_DECLARE(PS2HubTests, mouse_protocol_);
+  PS2Keyboard keyboard_;
+  PS2Mouse mouse_;
+  PS2Hub hub_;
+ private:
+  void SetUp() override {
+    EXPECT_TRUE(keyboard_protocol_.begin(2, 4));
+    EXPECT_TRUE(mouse_protocol_.begin(3, 5));
+    EXPECT_TRUE(keyboard_.begin(&keyboard_protocol_));
+    EXPECT_TRUE(mouse_.begin(&mouse_protocol_));
+    EXPECT_EQ(0, hub_.addKeyboard(&keyboard_));
+    EXPECT_EQ(1, hub_.addMouse(&mouse_));
+  }
+};
+
+PS2P_IMPLEMENT(PS2HubTests, keyboard_protocol_);
+PS2P_IMPLEMENT(PS2HubTests, mouse_protocol_);
+
+TEST_F(PS2HubTests, AddPorts) {
+  EXPECT_EQ(2, hub_.ports());
+  EXPECT_EQ(-1, hub_.addKeyboard(0));
+  EXPECT_EQ(-1, hub_.addMouse(0));
+
+  for (int i = hub_.ports(); i < PS2Hub::kMaxPorts; ++i)
+    EXPECT_EQ(i, hub_.addKeyboard(&keyboard_));
+  EXPECT_EQ(-1, hub_.addMouse(&mouse_));
+
+  hub_.end();
+  EXPECT_EQ(0, hub_.ports());
+  EXPECT_EQ(0, hub_.available());
+}
+
+TEST_F(PS2HubTests, Empty) {
+  EXPECT_EQ(0, hub_.available());
+
+  PS2Hub::Event event = hub_.read();
+  EXPECT_EQ(PS2Hub::DEVICE_NONE, event.type);
+  EXPECT_FALSE(event.isKey());
+  EXPECT_FALSE(event.isMotion());
+}
+
+#if PS2_TIMESTAMPS
+TEST_F(PS2HubTests, OldestFirst) {
+  // The mouse is on the second port, but moves first.
+  arduino::mock::SetMicros(0x10000);
+  SendPacket(0x08, 0x05, 0x00);
+  arduino::mock::AdvanceMicros(0x1000);
+  SendKey(kMakeA);
+  arduino::mock::AdvanceMicros(0x1000);
+  SendKey(kMakeB);
+  EXPECT_EQ(3, hub_.available());
+
+  PS2Hub::Event event = hub_.read();
+  EXPECT_TRUE(event.isMotion());
+  EXPECT_EQ(1, event.port);
+  EXPECT_EQ(5, event.motion.x);
+  EXPECT_EQ(0x10000UL, event.timestamp);
+
+  event = hub_.read();
+  EXPECT_TRUE(event.isKey());
+  EXPECT_EQ(0, event.port);
+  EXPECT_EQ(PS2Keyboard::KC_A, event.key.code());
+  EXPECT_EQ(0x11000UL, event.timestamp);
+
+  event = hub_.read();
+  EXPECT_EQ(PS2Keyboard::KC_B, event.key.code());
+  EXPECT_EQ(0x12000UL, event.timestamp);
+  EXPECT_EQ(0, hub_.available());
+}
+#endif
+
+TEST_F(PS2HubTests, SameTimeTakesTurns) {
+  // Two keys and two mouse events, one per change of buttons, all received
+  // at the same time.
+  SendKey(kMakeA);
+  SendKey(kMakeB);
+  SendPacket(0x08, 0x01, 0x00);
+  SendPacket(0x09, 0x00, 0x00);
+  EXPECT_EQ(4, hub_.available());
+
+  EXPECT_EQ(PS2Keyboard::KC_A, hub_.read().key.code());
+  EXPECT_EQ(0, hub_.read().motion.buttons);
+  EXPECT_EQ(PS2Keyboard::KC_B, hub_.read().key.code());
+  EXPECT_EQ(PS2Mouse::BUTTON_LEFT, hub_.read().motion.buttons);
+}
+
+TEST_F(PS2HubTests, KeyboardDecodingInIsr) {
+  keyboard_.setDecodeInIsr(true);
+  SendKey(kMakeA);
+  EXPECT_EQ(0, keyboard_.decodeBytes(1));
+  SendPacket(0x08, 0x01, 0x00);
+  EXPECT_EQ(2, hub_.available());
+
+  PS2Hub::Event event = hub_.read();
+  EXPECT_TRUE(event.isKey());
+  EXPECT_EQ(PS2Keyboard::KC_A, event.key.code());
+  EXPECT_TRUE(hub_.read().isMotion());
+  EXPECT_EQ(0, hub_.available());
+}
+
+TEST_F(PS2HubTests, Budget) {
+  const byte keys[] = {kMakeA, kMakeB, kMakeA, kMakeB, kMakeA, kMakeB};
+  for (int i = 0; i < numberof(keys); ++i)
+    SendKey(keys[i]);
+  SendPacket(0x08, 0x01, 0x00);
+  hub_.setBudget(4);
+  EXPECT_EQ(4, hub_.getBudget());
+
+  // The busy keyboard does not keep the mouse waiting.
+  EXPECT_EQ(4, hub_.poll());
+  EXPECT_EQ(2, keyboard_.buffered());
+  EXPECT_EQ(0, mouse_.buffered());
+
+  // The mouse goes first this time.
+  EXPECT_EQ(4, hub_.poll());
+  EXPECT_EQ(5, keyboard_.buffered());
+  EXPECT_EQ(1, mouse_.buffered());
+
+  EXPECT_EQ(7, hub_.available());
+  EXPECT_EQ(0, hub_.poll());
+
+  hub_.setBudget(0);
+  for (int i = 0; i < numberof(keys); ++i)
+    SendKey(keys[i]);
+  EXPECT_EQ(6, hub_.poll());
+}
+
+TEST_F(PS2HubTests, Stats) {
+  // One byte more than the protocol buffer holds.
+  for (int i = 0; i <= PS2Protocol::kBufferSize; ++i)
+    SendKey(kMakeA);
+  // A byte without the sync bit, then a packet.
+  SendFrame(&mouse_protocol_, 0x00);
+  SendPacket(0x08, 0x01, 0x00);
+
+  PS2Hub::PortStats stats = hub_.getStats(0);
+  EXPECT_EQ(PS2Protocol::kBufferSize, stats.backlog);
+  EXPECT_EQ(0, stats.peak_backlog);
+  EXPECT_EQ(1, stats.frames_dropped);
+
+  EXPECT_EQ(PS2Protocol::kBufferSize + 1, hub_.available());
+  stats = hub_.getStats(0);
+  EXPECT_EQ(0, stats.backlog);
+  EXPECT_EQ(PS2Protocol::kBufferSize, stats.peak_backlog);
+  EXPECT_EQ(PS2Protocol::kBufferSize, stats.bytes);
+  EXPECT_EQ(0, stats.sync_errors);
+  EXPECT_EQ(0, stats.events);
+
+  stats = hub_.getStats(1);
+  EXPECT_EQ(4, stats.peak_backlog);
+  EXPECT_EQ(4, stats.bytes);
+  EXPECT_EQ(0, stats.frames_dropped);
+  EXPECT_EQ(1, stats.sync_errors);
+
+  while (hub_.available() > 0)
+    hub_.read();
+  EXPECT_EQ(PS2Protocol::kBufferSize, hub_.getStats(0).events);
+  EXPECT_EQ(1, hub_.getStats(1).events);
+
+  hub_.resetStats();
+  stats = hub_.getStats(0);
+  EXPECT_EQ(0, stats.peak_backlog);
+  EXPECT_EQ(0, stats.frames_dropped);
+  EXPECT_EQ(0, stats.bytes);
+  EXPECT_EQ(0, stats.events);
+  EXPECT_EQ(0, hub_.getStats(1).sync_errors);
+
+  // Ports out of range have no statistics.
+  EXPECT_EQ(0, hub_.getStats(2).bytes);
+  EXPECT_EQ(0, hub_.getStats(-1).bytes);
+}
@@ -4,6 +4,7 @@
 #include "ps2_keyboard.h"
 #include "ps2_keyboard_manager.h"
 #include "ps2_protocol.h"
+#include "ps2_test_device.h"
 
 #define numberof(a) (sizeof(a)/sizeof((a)[0]))
 
@@ -59,25 +60,26 @@ TEST_F(PS2KeyboardManagerBeginTests, BeginWithNullKeyboard) {
   EXPECT_FALSE(manager_.begin(0, 0));
 }
 
+TEST_F(PS2KeyboardManagerBeginTests, SoftwareTypematicBeforeBegin) {
+  EXPECT_FALSE(manager_.setSoftwareTypematic(500, 100));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
-class PS2KeyboardManagerTests : public testing::TestCase,
-                                public arduino::mock::DelayHook {
+class PS2KeyboardManagerTests : public testing::TestCase {
  protected:
+  PS2KeyboardManagerTests() : device_(&protocol_) {}
+
   PS2P_DECLARE(PS2KeyboardManagerTests, protocol_);
   PS2Keyboard keyboard_;
   PS2KeyboardManager manager_;
+  PS2TestDevice device_;
  private:
   void SetUp() override {
     EXPECT_TRUE(protocol_.begin(2, 3));
     EXPECT_TRUE(keyboard_.begin(&protocol_));
     EXPECT_TRUE(manager_.begin(&keyboard_, 0));
-  }
-
-  void RunDelayHook() override {
-    // Generate a clock tick.  The parity bit may be wrong, but there is no
-    // real device on the other end to check, so all is fine.
-    protocol_.callIsrHandlerForTesting(LOW);
+    device_.begin();
   }
 };
 
@@ -146,6 +148,21 @@ TEST_F(PS2KeyboardManagerTests, ReportKey) {
   EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_C));
 }
 
+#if PS2_TIMESTAMPS
+TEST_F(PS2KeyboardManagerTests, ReportTimestamp) {
+  arduino::mock::SetMicros(0x12345600);
+  byte timestamp = PS2Timestamp::fromMicros(micros());
+  keyboard_.processByteForTesting(kMakeCodeA, timestamp);
+  arduino::mock::AdvanceMicros(10000);
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_EQ(0x12345600, report.timestamp);
+
+  // Periodic reports do not come from a key.
+  report = manager_.read();
+  EXPECT_EQ(0, report.timestamp);
+}
+#endif
+
 TEST_F(PS2KeyboardManagerTests, ReportPauseCleared) {
   // This sequence will generate a Pause key.
   keyboard_.processByteForTesting(kMakeCodeE1);
@@ -163,11 +180,10 @@ TEST_F(PS2KeyboardManagerTests, ReportPauseCleared) {
 }
 
 TEST_F(PS2KeyboardManagerTests, CapsLockSetLED) {
-  // Register a delay hook because the call to available() will cause the
-  // manager to try and send commands to the ketyboard, which will block.
-  // The hook will let the test pump the clock line to complete the send
-  // operation.
-  arduino::mock::ScopedDelayHook hook(this);
+  // Register a delay hook in case the manager waits for commands sent to the
+  // keyboard.  The hook will let the test pump the clock line to complete the
+  // send operation.
+  arduino::mock::ScopedDelayHook hook(&device_);
 
   // LED starts out off.
   EXPECT_EQ(0, manager_.getLEDs());
@@ -199,6 +215,88 @@ TEST_F(PS2KeyboardManagerTests, CapsLockSetLED) {
   EXPECT_EQ(0, (int)manager_.getLEDs());
 }
 
+TEST_F(PS2KeyboardManagerTests, LEDsSentByAvailable) {
+  manager_.setLEDs(PS2KeyboardManager::LED_NUM_LOCK,
+                   PS2KeyboardManager::LED_NUM_LOCK);
+  EXPECT_EQ(PS2KeyboardManager::LED_NUM_LOCK, (int)manager_.getLEDs());
+  EXPECT_EQ(0, protocol_.writePending());
+
+  manager_.available();
+  EXPECT_EQ(2, protocol_.writePending());
+}
+
+TEST_F(PS2KeyboardManagerTests, LEDsSentWithDecodeInIsr) {
+  keyboard_.setDecodeInIsr(true);
+  manager_.setLEDs(PS2KeyboardManager::LED_NUM_LOCK,
+                   PS2KeyboardManager::LED_NUM_LOCK);
+  manager_.available();
+  EXPECT_EQ(2, protocol_.writePending());
+
+  // available() alone moves the command along and releases the clock.
+  arduino::mock::ScopedDelayHook hook(&device_);
+  for (int i = 0; i < 100 && protocol_.writePending() > 0; ++i) {
+    delayMicroseconds(50);
+    manager_.available();
+  }
+  EXPECT_EQ(0, protocol_.writePending());
+  EXPECT_EQ(PS2Protocol::WRITE_DONE, protocol_.writeStatus());
+  EXPECT_EQ(INPUT_PULLUP, arduino::mock::GetPinMode(2));
+}
+
+TEST_F(PS2KeyboardManagerTests, LEDsResentAfterFailure) {
+  manager_.setLEDs(PS2KeyboardManager::LED_NUM_LOCK,
+                   PS2KeyboardManager::LED_NUM_LOCK);
+  manager_.available();
+  EXPECT_EQ(2, protocol_.writePending());
+
+  // The device never clocks in the command, so it times out.
+  delay(1);
+  manager_.available();
+  delay(20);
+  manager_.available();
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, protocol_.writeStatus());
+  manager_.available();
+  EXPECT_EQ(2, protocol_.writePending());
+
+  // Once the device takes it, the command is not sent again.
+  {
+    arduino::mock::ScopedDelayHook hook(&device_);
+    while (protocol_.writePending() > 0) {
+      delayMicroseconds(50);
+      protocol_.poll();
+    }
+  }
+  EXPECT_EQ(PS2Protocol::WRITE_DONE, protocol_.writeStatus());
+  manager_.available();
+  manager_.available();
+  EXPECT_EQ(0, protocol_.writePending());
+}
+
+TEST_F(PS2KeyboardManagerTests, LEDsCoalesced) {
+  // Toggle CAPS LOCK three times while the first command is in flight.
+  for (int i = 0; i < 3; ++i) {
+    keyboard_.processByteForTesting(kBreak);
+    keyboard_.processByteForTesting(kMakeCodeCapsLock);
+    manager_.available();
+    PS2KeyboardManager::Report report = manager_.read();
+    manager_.available();
+    EXPECT_EQ(2, protocol_.writePending());
+  }
+  EXPECT_EQ(PS2KeyboardManager::LED_CAPS_LOCK, (int)manager_.getLEDs());
+
+  // The device never clocks in the command, so it times out, and then the
+  // last state is sent in a single command.
+  delay(1);
+  manager_.available();
+  delay(20);
+  manager_.available();
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, protocol_.writeStatus());
+  manager_.available();
+  EXPECT_EQ(2, protocol_.writePending());
+  manager_.available();
+  EXPECT_EQ(2, protocol_.writePending());
+}
+
 // Keyboard manager that transforms all keys to A.
 class TransformingKeyboardManager : public PS2KeyboardManager {
   PS2Keyboard::Key transformKey(PS2Keyboard::Key key) override {
@@ -237,4 +335,484 @@ TEST_F(PS2KeyboardManagerTests, ReportMoreThan6Keys) {
   }
 }
 
+TEST_F(PS2KeyboardManagerTests, ReportKeysInPressOrder) {
+  keyboard_.processByteForTesting(kMakeCodeC);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  keyboard_.processByteForTesting(kMakeCodeLSHFT);
+  PS2KeyboardManager::Report report;
+  while (manager_.available() > 0)
+    report = manager_.read();
+  EXPECT_EQ(PS2Keyboard::KC_C, report.keycodes[0]);
+  EXPECT_EQ(PS2Keyboard::KC_A, report.keycodes[1]);
+  EXPECT_EQ(PS2Keyboard::KC_B, report.keycodes[2]);
+  EXPECT_EQ(0, report.keycodes[3]);
+
+  // Releasing a key moves the later ones up, and pressing one again puts it
+  // at the end.
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeC);
+  keyboard_.processByteForTesting(kMakeCodeC);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  while (manager_.available() > 0)
+    report = manager_.read();
+  EXPECT_EQ(PS2Keyboard::KC_A, report.keycodes[0]);
+  EXPECT_EQ(PS2Keyboard::KC_B, report.keycodes[1]);
+  EXPECT_EQ(PS2Keyboard::KC_C, report.keycodes[2]);
+  EXPECT_EQ(0, report.keycodes[3]);
+}
+
+TEST_F(PS2KeyboardManagerTests, Report6Keys) {
+  const byte codes[] = {kMakeCodeA, kMakeCodeB, kMakeCodeC,
+                        kMakeCodeD, kMakeCodeE, kMakeCodeF};
+  for (int i = 0; i < numberof(codes); ++i)
+    keyboard_.processByteForTesting(codes[i]);
+  PS2KeyboardManager::Report report;
+  while (manager_.available() > 0)
+    report = manager_.read();
+  EXPECT_EQ(PS2Keyboard::KC_A, report.keycodes[0]);
+  EXPECT_EQ(PS2Keyboard::KC_F, report.keycodes[5]);
+}
+
+TEST_F(PS2KeyboardManagerTests, ReportAfterRollOver) {
+  const byte codes[] = {kMakeCodeA, kMakeCodeB, kMakeCodeC, kMakeCodeD,
+                        kMakeCodeE, kMakeCodeF, kMakeCodeG};
+  for (int i = 0; i < numberof(codes); ++i)
+    keyboard_.processByteForTesting(codes[i]);
+  PS2KeyboardManager::Report report;
+  while (manager_.available() > 0)
+    report = manager_.read();
+  EXPECT_EQ(PS2Keyboard::KC_ERROR_ROLL_OVER, report.keycodes[0]);
+
+  // Releasing one key brings back all the others, including G which was
+  // pressed while the list was full.
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  report = manager_.read();
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_B));
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_ERROR_ROLL_OVER));
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_G));
+}
+
+TEST_F(PS2KeyboardManagerTests, ReportChanged) {
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_FALSE(manager_.reportChanged());
+
+  keyboard_.processByteForTesting(kMakeCodeLSHFT);
+  report = manager_.read();
+  EXPECT_TRUE(manager_.reportChanged());
+  EXPECT_EQ(PS2KeyboardManager::M_LSHFT, report.modifiers);
+
+  // A typematic repeat does not change the report.
+  keyboard_.processByteForTesting(kMakeCodeLSHFT);
+  report = manager_.read();
+  EXPECT_FALSE(manager_.reportChanged());
+  EXPECT_EQ(PS2KeyboardManager::M_LSHFT, report.modifiers);
+
+  // Neither does a periodic report.
+  report = manager_.read();
+  EXPECT_FALSE(manager_.reportChanged());
+
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeLSHFT);
+  report = manager_.read();
+  EXPECT_TRUE(manager_.reportChanged());
+  EXPECT_EQ(0, report.modifiers);
+}
+
+TEST_F(PS2KeyboardManagerTests, ReportChangedAfterPause) {
+  keyboard_.processByteForTesting(kMakeCodeE1);
+  keyboard_.processByteForTesting(kMakeCode77);
+  keyboard_.processByteForTesting(kMakeCode77);
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_TRUE(manager_.reportChanged());
+  report = manager_.read();
+  EXPECT_TRUE(manager_.reportChanged());
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_PAUSE));
+  report = manager_.read();
+  EXPECT_FALSE(manager_.reportChanged());
+}
+
+TEST_F(PS2KeyboardManagerTests, BootReportData) {
+  keyboard_.processByteForTesting(kMakeCodeLSHFT);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  PS2KeyboardManager::Report report = manager_.read();
+  report = manager_.read();
+  const byte expected[PS2KeyboardManager::Report::kSize] = {
+    PS2KeyboardManager::M_LSHFT, 0, PS2Keyboard::KC_B, 0, 0, 0, 0, 0
+  };
+  EXPECT_EQ(0, memcmp(expected, report.data(), sizeof(expected)));
+}
+
+TEST_F(PS2KeyboardManagerTests, NkroReport) {
+  EXPECT_EQ(22, PS2KeyboardManager::NkroReport::kSize);
+
+  // More keys than fit in a boot report.
+  const byte codes[] = {kMakeCodeA, kMakeCodeB, kMakeCodeC, kMakeCodeD,
+                        kMakeCodeE, kMakeCodeF, kMakeCodeG, kMakeCodeRSHFT};
+  PS2KeyboardManager::NkroReport report;
+  for (int i = 0; i < numberof(codes); ++i) {
+    keyboard_.processByteForTesting(codes[i]);
+    report = manager_.readNkro();
+  }
+  EXPECT_EQ(PS2KeyboardManager::M_RSHFT, report.modifiers);
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_G));
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_H));
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_RSHFT));
+
+  // Key codes A to G are 4 to 10.
+  const byte* data = report.data();
+  EXPECT_EQ(PS2KeyboardManager::M_RSHFT, data[0]);
+  EXPECT_EQ(0xF0, data[1]);
+  EXPECT_EQ(0x07, data[2]);
+  for (int i = 3; i < PS2KeyboardManager::NkroReport::kSize; ++i)
+    EXPECT_EQ(0, data[i]);
+
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  report = manager_.readNkro();
+  EXPECT_TRUE(manager_.reportChanged());
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_A));
+}
+
+TEST_F(PS2KeyboardManagerTests, NkroReportPauseCleared) {
+  keyboard_.processByteForTesting(kMakeCodeE1);
+  keyboard_.processByteForTesting(kMakeCode77);
+  keyboard_.processByteForTesting(kMakeCode77);
+  PS2KeyboardManager::NkroReport report = manager_.readNkro();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_PAUSE));
+  report = manager_.readNkro();
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_PAUSE));
+}
+
+namespace {
+
+unsigned long g_clock;
+
+unsigned long TestClock() {
+  return g_clock;
+}
+
+}  // namespace
+
+TEST_F(PS2KeyboardManagerTests, PeriodicReports) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  EXPECT_TRUE(manager_.begin(&keyboard_, 10));
+  EXPECT_EQ(1, manager_.available());
+  PS2KeyboardManager::Report report = manager_.read();
+
+  // The next periodic report is due 10 msec after the last read().
+  EXPECT_EQ(0, manager_.available());
+  g_clock += 9;
+  EXPECT_EQ(0, manager_.available());
+  g_clock += 1;
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+  EXPECT_EQ(0, manager_.available());
+}
+
+TEST_F(PS2KeyboardManagerTests, PollInterval) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  manager_.setPollInterval(8);
+
+  // A key is reported right away.
+  keyboard_.processByteForTesting(kMakeCodeA);
+  EXPECT_EQ(1, manager_.available());
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+
+  // Keys that arrive during the same interval wait for the next one, and
+  // are all in one report.
+  g_clock += 2;
+  keyboard_.processByteForTesting(kMakeCodeB);
+  EXPECT_EQ(0, manager_.available());
+  g_clock += 2;
+  keyboard_.processByteForTesting(kMakeCodeC);
+  EXPECT_EQ(0, manager_.available());
+  g_clock += 4;
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_B));
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_C));
+  EXPECT_EQ(0, manager_.available());
+
+  // A press and release in the same interval still take two reports.
+  g_clock += 20;
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_B));
+  EXPECT_EQ(0, manager_.available());
+  g_clock += 8;
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_B));
+}
+
+TEST_F(PS2KeyboardManagerTests, SoftwareTypematic) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  EXPECT_TRUE(manager_.setSoftwareTypematic(500, 100));
+  EXPECT_EQ(2, protocol_.writePending());
+
+  keyboard_.processByteForTesting(kMakeCodeA);
+  EXPECT_EQ(1, manager_.available());
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+  EXPECT_EQ(0, manager_.available());
+
+  g_clock += 499;
+  EXPECT_EQ(0, manager_.available());
+  g_clock += 1;
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+  EXPECT_FALSE(manager_.reportChanged());
+  EXPECT_EQ(0, manager_.available());
+
+  g_clock += 100;
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+  EXPECT_EQ(0, manager_.available());
+
+  // A new key takes over the repeat, with a new delay.
+  keyboard_.processByteForTesting(kMakeCodeB);
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+  g_clock += 100;
+  EXPECT_EQ(0, manager_.available());
+  g_clock += 400;
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+
+  // Releasing the key stops the repeat.
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  report = manager_.read();
+  g_clock += 1000;
+  EXPECT_EQ(0, manager_.available());
+}
+
+// Keyboard manager that remaps B to C, and counts the keys it transforms.
+class RemappingKeyboardManager : public PS2KeyboardManager {
+ public:
+  RemappingKeyboardManager() : transformed(0) {}
+  int transformed;
+ private:
+  PS2Keyboard::Key transformKey(PS2Keyboard::Key key) override {
+    ++transformed;
+    if (key.code() != PS2Keyboard::KC_B)
+      return key;
+    return PS2Keyboard::Key(PS2Keyboard::KC_C, key.type());
+  }
+};
+
+TEST_F(PS2KeyboardManagerTests, SoftwareTypematicTransformsRepeats) {
+  g_clock = 1000;
+  RemappingKeyboardManager remapper;
+  remapper.begin(&keyboard_, 0);
+  remapper.setClock(TestClock);
+  EXPECT_TRUE(remapper.setSoftwareTypematic(500, 100));
+
+  keyboard_.processByteForTesting(kMakeCodeB);
+  PS2KeyboardManager::Report report = remapper.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_C));
+  EXPECT_EQ(1, remapper.transformed);
+
+  // The repeat goes through transformKey() again.
+  g_clock += 500;
+  EXPECT_EQ(1, remapper.available());
+  report = remapper.read();
+  EXPECT_EQ(2, remapper.transformed);
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_C));
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_B));
+  EXPECT_FALSE(remapper.reportChanged());
+
+  // Releasing the key stops the repeat.
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  report = remapper.read();
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_C));
+  g_clock += 1000;
+  EXPECT_EQ(0, remapper.available());
+}
+
+TEST_F(PS2KeyboardManagerTests, SoftwareTypematicNotQueued) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  for (int i = 0; i < PS2Protocol::kWriteBufferSize - 1; ++i)
+    EXPECT_TRUE(protocol_.write(0xEE));
+  EXPECT_FALSE(manager_.setSoftwareTypematic(500, 100));
+
+  // The keyboard still repeats the key, nothing is repeated in software.
+  keyboard_.processByteForTesting(kMakeCodeA);
+  PS2KeyboardManager::Report report = manager_.read();
+  g_clock += 1000;
+  EXPECT_EQ(0, manager_.available());
+}
+
+TEST_F(PS2KeyboardManagerTests, SoftwareTypematicSkipsModifiers) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  manager_.setSoftwareTypematic(500, 100);
+  keyboard_.processByteForTesting(kMakeCodeLSHFT);
+  PS2KeyboardManager::Report report = manager_.read();
+  g_clock += 1000;
+  EXPECT_EQ(0, manager_.available());
+}
+
+TEST_F(PS2KeyboardManagerTests, CoalesceKeys) {
+  manager_.setCoalesceKeys(true);
+  keyboard_.processByteForTesting(kMakeCodeLSHFT);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_EQ(0, manager_.available());
+  EXPECT_TRUE(report.isShiftPressed());
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_B));
+}
+
+TEST_F(PS2KeyboardManagerTests, CoalesceKeysSplitsPressAndRelease) {
+  manager_.setCoalesceKeys(true);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  keyboard_.processByteForTesting(kMakeCodeB);
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  keyboard_.processByteForTesting(kMakeCodeC);
+
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_B));
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_C));
+  EXPECT_EQ(2, manager_.available());
+
+  report = manager_.read();
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_A));
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_B));
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_C));
+  EXPECT_EQ(0, manager_.available());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+class PS2KeyboardManagerScanCodeSetTests : public testing::TestCase {
+ protected:
+  PS2KeyboardManagerScanCodeSetTests() : device_(&protocol_) {}
+
+  // Responds to the 0xF0 commands of selectScanCodeSet() with |set|.
+  void RespondWithSet(byte set) {
+    const byte bytes[] = {0xFA, 0xFA, 0xFA, 0xFA, set};
+    device_.Respond(bytes, numberof(bytes));
+  }
+
+  PS2P_DECLARE(PS2KeyboardManagerScanCodeSetTests, protocol_);
+  PS2Keyboard keyboard_;
+  PS2KeyboardManager manager_;
+  PS2TestDevice device_;
+ private:
+  void SetUp() override {
+    EXPECT_TRUE(protocol_.begin(2, 3));
+    EXPECT_TRUE(keyboard_.begin(&protocol_));
+    EXPECT_TRUE(manager_.begin(&keyboard_, 0));
+    device_.begin();
+  }
+};
+
+PS2P_IMPLEMENT(PS2KeyboardManagerScanCodeSetTests, protocol_);
+
+TEST_F(PS2KeyboardManagerScanCodeSetTests, SelectSet3) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  RespondWithSet(3);
+  EXPECT_TRUE(manager_.selectScanCodeSet(PS2Keyboard::SCAN_CODE_SET_3));
+  EXPECT_EQ(PS2Keyboard::SCAN_CODE_SET_3, keyboard_.getScanCodeSet());
+  EXPECT_EQ(PS2Protocol::WRITE_DONE, protocol_.writeStatus());
+
+  keyboard_.processByteForTesting(0x1C);  // Set 3 make code of A.
+  EXPECT_EQ(1, manager_.available());
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+
+  // A reset goes back to set 2.
+  manager_.resetKeyboard();
+  EXPECT_EQ(PS2Keyboard::SCAN_CODE_SET_2, keyboard_.getScanCodeSet());
+}
+
+TEST_F(PS2KeyboardManagerScanCodeSetTests, SelectSetNotSupported) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  RespondWithSet(2);
+  EXPECT_FALSE(manager_.selectScanCodeSet(PS2Keyboard::SCAN_CODE_SET_3));
+  EXPECT_EQ(PS2Keyboard::SCAN_CODE_SET_2, keyboard_.getScanCodeSet());
+}
+
+TEST_F(PS2KeyboardManagerScanCodeSetTests, SelectSetNoResponse) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  EXPECT_FALSE(manager_.selectScanCodeSet(PS2Keyboard::SCAN_CODE_SET_3));
+  EXPECT_EQ(PS2Keyboard::SCAN_CODE_SET_2, keyboard_.getScanCodeSet());
+}
+
+TEST_F(PS2KeyboardManagerScanCodeSetTests, KeyModeNeedsSet3) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  EXPECT_FALSE(manager_.setKeyMode(PS2Keyboard::KC_A,
+                                   PS2KeyboardManager::KEY_MODE_MAKE));
+}
+
+TEST_F(PS2KeyboardManagerScanCodeSetTests, KeyModeMake) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  RespondWithSet(3);
+  EXPECT_TRUE(manager_.selectScanCodeSet(PS2Keyboard::SCAN_CODE_SET_3));
+  EXPECT_TRUE(manager_.setKeyMode(PS2Keyboard::KC_A,
+                                  PS2KeyboardManager::KEY_MODE_MAKE));
+  EXPECT_FALSE(manager_.setKeyMode(PS2Keyboard::KC_LSHFT,
+                                   PS2KeyboardManager::KEY_MODE_MAKE));
+  EXPECT_TRUE(manager_.setKeyMode(PS2Keyboard::KC_LSHFT,
+                                  PS2KeyboardManager::KEY_MODE_MAKE_BREAK));
+
+  // The key is released once reported, since it has no break code.
+  keyboard_.processByteForTesting(0x1C);
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+  EXPECT_FALSE(manager_.isKeyPressed(PS2Keyboard::KC_A));
+
+  keyboard_.processByteForTesting(0x1C);
+  report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_A));
+}
+
+TEST_F(PS2KeyboardManagerScanCodeSetTests, PauseHasBreakCodeInSet3) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  RespondWithSet(3);
+  EXPECT_TRUE(manager_.selectScanCodeSet(PS2Keyboard::SCAN_CODE_SET_3));
+
+  // Pause stays pressed until its break code arrives.
+  byte pause = PS2Keyboard::scanCode(PS2Keyboard::KC_PAUSE,
+                                     PS2Keyboard::SCAN_CODE_SET_3);
+  keyboard_.processByteForTesting(pause);
+  PS2KeyboardManager::Report report = manager_.read();
+  EXPECT_TRUE(report.isKeyPressed(PS2Keyboard::KC_PAUSE));
+  EXPECT_TRUE(manager_.isKeyPressed(PS2Keyboard::KC_PAUSE));
+
+  keyboard_.processByteForTesting(0xF0);
+  keyboard_.processByteForTesting(pause);
+  report = manager_.read();
+  EXPECT_FALSE(report.isKeyPressed(PS2Keyboard::KC_PAUSE));
+}
+
+TEST_F(PS2KeyboardManagerScanCodeSetTests, SelectSetDropsKeys) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  keyboard_.processByteForTesting(0x1C);  // Set 2 make code of A.
+  EXPECT_EQ(1, keyboard_.buffered());
+
+  RespondWithSet(3);
+  EXPECT_TRUE(manager_.selectScanCodeSet(PS2Keyboard::SCAN_CODE_SET_3));
+  EXPECT_EQ(0, keyboard_.buffered());
+  EXPECT_EQ(0, manager_.available());
+}
+
 // Figure out why a max of 4 keys can be held down at once.
@@ -1,9 +1,11 @@
 
 #include <iostream>
+#include <vector>
 #include <unit_tests.h>
 
 #include "ps2_keyboard.h"
 #include "ps2_protocol.h"
+#include "ps2_test_device.h"
 
 #define numberof(a) (sizeof(a)/sizeof((a)[0]))
 
@@ -70,8 +72,20 @@ class PS2KeyboardTests : public testing::TestCase {
   static const byte kUp_KP8;
 
  protected:
+  static void KeyCallback(void* context, PS2Keyboard::Key key) {
+    static_cast<PS2KeyboardTests*>(context)->keys_.push_back(key);
+  }
+
+  // Handler for dispatch().
+  struct KeyCollector {
+    KeyCollector(std::vector<PS2Keyboard::Key>* keys) : keys(keys) {}
+    void operator()(PS2Keyboard::Key key) { keys->push_back(key); }
+    std::vector<PS2Keyboard::Key>* keys;
+  };
+
   PS2P_DECLARE(PS2KeyboardTests, protocol_);
   PS2Keyboard keyboard_;
+  std::vector<PS2Keyboard::Key> keys_;
  private:
   void SetUp() override {
     EXPECT_TRUE(protocol_.begin(2, 3));
@@ -308,6 +322,162 @@ TEST_F(PS2KeyboardTests, BufferOverflow) {
   }
 }
 
+TEST_F(PS2KeyboardTests, BufferWrapsAround) {
+  // The buffer indices are free running bytes, so go around them a few times
+  // with the buffer full.
+  for (int i = 0; i < PS2Keyboard::kBufferSize; ++i)
+    keyboard_.processByteForTesting(kMakeCodeA);
+  for (int i = 0; i < 600; ++i) {
+    EXPECT_EQ(PS2Keyboard::kBufferSize, keyboard_.available());
+    EXPECT_EQ(PS2Keyboard::KC_A, keyboard_.read().code());
+    keyboard_.processByteForTesting(kMakeCodeA);
+  }
+  EXPECT_EQ(PS2Keyboard::kBufferSize, keyboard_.available());
+}
+
+#if PS2_TIMESTAMPS
+TEST_F(PS2KeyboardTests, TimestampOfFirstByte) {
+  keyboard_.processByteForTesting(kExtended, 5);
+  keyboard_.processByteForTesting(kBreak, 6);
+  keyboard_.processByteForTesting(kMakeCodeHome, 7);
+  keyboard_.processByteForTesting(kMakeCodeA, 8);
+  EXPECT_EQ(2, keyboard_.available());
+  EXPECT_EQ(5, keyboard_.read().timestamp());
+  EXPECT_EQ(8, keyboard_.read().timestamp());
+}
+#endif
+
+TEST_F(PS2KeyboardTests, KeyCallback) {
+  keyboard_.setKeyCallback(KeyCallback, this);
+  SendFrame(&protocol_, kMakeCodeA);
+  SendFrame(&protocol_, kBreak);
+  SendFrame(&protocol_, kMakeCodeA);
+  EXPECT_EQ(0, keyboard_.available());
+  EXPECT_EQ(2, keys_.size());
+  EXPECT_EQ(PS2Keyboard::KC_A, keys_[0].code());
+  EXPECT_TRUE(keys_[0].isPressed());
+  EXPECT_EQ(PS2Keyboard::KC_A, keys_[1].code());
+  EXPECT_TRUE(keys_[1].isReleased());
+
+  // Back to buffering.
+  keyboard_.setKeyCallback(0);
+  SendFrame(&protocol_, kMakeCodeB);
+  EXPECT_EQ(1, keyboard_.available());
+  EXPECT_EQ(2, keys_.size());
+}
+
+TEST_F(PS2KeyboardTests, Dispatch) {
+  // Buffered keys come first.
+  keyboard_.processByteForTesting(kMakeCodeC);
+  SendFrame(&protocol_, kExtended);
+  SendFrame(&protocol_, kMakeCodeHome);
+  SendFrame(&protocol_, kMakeCodeB);
+  KeyCollector collector(&keys_);
+  keyboard_.dispatch(collector);
+  EXPECT_EQ(3, keys_.size());
+  EXPECT_EQ(PS2Keyboard::KC_C, keys_[0].code());
+  EXPECT_EQ(PS2Keyboard::KC_HOME, keys_[1].code());
+  EXPECT_EQ(PS2Keyboard::KC_B, keys_[2].code());
+  EXPECT_EQ(0, keyboard_.available());
+}
+
+namespace {
+
+int g_dispatched_keys;
+
+void CountKey(PS2Keyboard::Key key) {
+  ++g_dispatched_keys;
+}
+
+}  // namespace
+
+TEST_F(PS2KeyboardTests, DispatchToFunction) {
+  g_dispatched_keys = 0;
+  SendFrame(&protocol_, kMakeCodeA);
+  SendFrame(&protocol_, kMakeCodeB);
+  keyboard_.dispatch(CountKey);
+  EXPECT_EQ(2, g_dispatched_keys);
+}
+
+TEST_F(PS2KeyboardTests, DecodeInIsr) {
+  keyboard_.setDecodeInIsr(true);
+  EXPECT_TRUE(keyboard_.getDecodeInIsr());
+
+  // The key is buffered by the ISR handler, no bytes are left for available()
+  // to process.
+  SendFrame(&protocol_, kMakeCodeA);
+  EXPECT_EQ(0, protocol_.available());
+  EXPECT_EQ(PS2Keyboard::KC_A, keyboard_.peek().code());
+  EXPECT_EQ(1, keyboard_.available());
+
+  keyboard_.setDecodeInIsr(false);
+  SendFrame(&protocol_, kMakeCodeB);
+  EXPECT_EQ(1, protocol_.available());
+  EXPECT_EQ(2, keyboard_.available());
+}
+
+TEST_F(PS2KeyboardTests, DecodeInIsrKeepsOrder) {
+  SendFrame(&protocol_, kMakeCodeA);
+  EXPECT_EQ(1, protocol_.buffered());
+  keyboard_.setDecodeInIsr(true);
+  EXPECT_EQ(0, protocol_.buffered());
+  EXPECT_EQ(1, keyboard_.buffered());
+  SendFrame(&protocol_, kMakeCodeB);
+  EXPECT_EQ(2, keyboard_.available());
+  EXPECT_EQ(PS2Keyboard::KC_A, keyboard_.read().code());
+  EXPECT_EQ(PS2Keyboard::KC_B, keyboard_.read().code());
+}
+
+TEST_F(PS2KeyboardTests, DecodeInIsrStopsAtEnd) {
+  keyboard_.setDecodeInIsr(true);
+  keyboard_.end();
+  SendFrame(&protocol_, kMakeCodeA);
+  EXPECT_EQ(1, protocol_.available());
+}
+
+TEST_F(PS2KeyboardTests, RepeatFilter) {
+  keyboard_.setRepeatFilter(true);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  keyboard_.processByteForTesting(kExtended);
+  keyboard_.processByteForTesting(kMakeCodeHome);
+  keyboard_.processByteForTesting(kExtended);
+  keyboard_.processByteForTesting(kMakeCodeHome);
+  EXPECT_EQ(3, keyboard_.getRepeatsFiltered());
+  EXPECT_EQ(2, keyboard_.available());
+  EXPECT_EQ(PS2Keyboard::KC_A, keyboard_.read().code());
+  EXPECT_EQ(PS2Keyboard::KC_HOME, keyboard_.read().code());
+
+  // Once released, the key can be pressed again.
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  keyboard_.processByteForTesting(kMakeCodeA);
+  EXPECT_EQ(2, keyboard_.available());
+  EXPECT_TRUE(keyboard_.read().isReleased());
+  EXPECT_TRUE(keyboard_.read().isPressed());
+  EXPECT_EQ(3, keyboard_.getRepeatsFiltered());
+}
+
+TEST_F(PS2KeyboardTests, RepeatFilterPreventsOverflow) {
+  keyboard_.setRepeatFilter(true);
+  for (int i = 0; i < PS2Keyboard::kBufferSize * 2; ++i)
+    keyboard_.processByteForTesting(kMakeCodeA);
+  EXPECT_EQ(1, keyboard_.available());
+  EXPECT_EQ(PS2Keyboard::kBufferSize * 2 - 1, keyboard_.getRepeatsFiltered());
+}
+
+TEST_F(PS2KeyboardTests, RepeatFilterKeepsPause) {
+  keyboard_.setRepeatFilter(true);
+  for (int i = 0; i < 2; ++i) {
+    keyboard_.processByteForTesting(0xE1);
+    keyboard_.processByteForTesting(0x77);
+    keyboard_.processByteForTesting(0x77);
+  }
+  EXPECT_EQ(2, keyboard_.available());
+  EXPECT_EQ(0, keyboard_.getRepeatsFiltered());
+}
+
 TEST_F(PS2KeyboardTests, Pause) {
   keyboard_.processByteForTesting(0xE1);
   keyboard_.processByteForTesting(0x14);
@@ -375,6 +545,140 @@ TEST_F(PS2KeyboardTests, PauseInvalidBeforeSecond77) {
   EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
 }
 
+TEST_F(PS2KeyboardTests, ScanCodeSet1) {
+  keyboard_.setScanCodeSet(PS2Keyboard::SCAN_CODE_SET_1);
+  EXPECT_EQ(PS2Keyboard::SCAN_CODE_SET_1, keyboard_.getScanCodeSet());
+  keyboard_.processByteForTesting(0x1E);  // A pressed
+  keyboard_.processByteForTesting(0x9E);  // A released
+  keyboard_.processByteForTesting(0xE0);  // Home pressed
+  keyboard_.processByteForTesting(0x47);
+  keyboard_.processByteForTesting(0xE0);  // Home released
+  keyboard_.processByteForTesting(0xC7);
+  EXPECT_EQ(4, keyboard_.available());
+
+  PS2Keyboard::Key k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_A, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
+  k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_A, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_RELEASED, k.type());
+  k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_HOME, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
+  k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_HOME, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_RELEASED, k.type());
+}
+
+TEST_F(PS2KeyboardTests, ScanCodeSet1PrintScreen) {
+  keyboard_.setScanCodeSet(PS2Keyboard::SCAN_CODE_SET_1);
+  const byte bytes[] = {0xE0, 0x2A, 0xE0, 0x37, 0xE0, 0xB7, 0xE0, 0xAA};
+  for (size_t i = 0; i < numberof(bytes); ++i)
+    keyboard_.processByteForTesting(bytes[i]);
+  EXPECT_EQ(2, keyboard_.available());
+  PS2Keyboard::Key k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_PRINT_SCREEN, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
+  k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_PRINT_SCREEN, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_RELEASED, k.type());
+}
+
+TEST_F(PS2KeyboardTests, ScanCodeSet1Pause) {
+  keyboard_.setScanCodeSet(PS2Keyboard::SCAN_CODE_SET_1);
+  const byte bytes[] = {0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5};
+  for (size_t i = 0; i < numberof(bytes); ++i)
+    keyboard_.processByteForTesting(bytes[i]);
+  EXPECT_EQ(1, keyboard_.available());
+  PS2Keyboard::Key k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_PAUSE, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
+
+  // An unexpected code aborts the sequence.
+  keyboard_.processByteForTesting(0xE1);
+  keyboard_.processByteForTesting(0x1E);
+  EXPECT_EQ(0, keyboard_.available());
+  EXPECT_EQ(PS2Keyboard::WAIT_START, keyboard_.getStateForTesting());
+}
+
+TEST_F(PS2KeyboardTests, ScanCodeSet3) {
+  keyboard_.setScanCodeSet(PS2Keyboard::SCAN_CODE_SET_3);
+  keyboard_.processByteForTesting(0x1C);  // A pressed
+  keyboard_.processByteForTesting(0x6E);  // Home pressed
+  keyboard_.processByteForTesting(0x62);  // Pause pressed
+  keyboard_.processByteForTesting(0xF0);  // Pause released
+  keyboard_.processByteForTesting(0x62);
+  keyboard_.processByteForTesting(0xFA);  // ACK, ignored
+  EXPECT_EQ(4, keyboard_.available());
+
+  PS2Keyboard::Key k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_A, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
+  k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_HOME, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
+  k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_PAUSE, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
+  k = keyboard_.read();
+  EXPECT_EQ(PS2Keyboard::KC_PAUSE, k.code());
+  EXPECT_EQ(PS2Keyboard::KEY_RELEASED, k.type());
+}
+
+TEST_F(PS2KeyboardTests, ScanCodeSet3BreakBreak) {
+  keyboard_.setScanCodeSet(PS2Keyboard::SCAN_CODE_SET_3);
+  keyboard_.processByteForTesting(kBreak);
+  keyboard_.processByteForTesting(kBreak);
+  EXPECT_EQ(PS2Keyboard::WAIT_START, keyboard_.getStateForTesting());
+  keyboard_.processByteForTesting(0x1C);
+  EXPECT_EQ(1, keyboard_.available());
+  EXPECT_EQ(PS2Keyboard::KEY_PRESSED, keyboard_.read().type());
+}
+
+TEST_F(PS2KeyboardTests, ScanCode) {
+  const PS2Keyboard::ScanCodeSet kSet1 = PS2Keyboard::SCAN_CODE_SET_1;
+  const PS2Keyboard::ScanCodeSet kSet2 = PS2Keyboard::SCAN_CODE_SET_2;
+  const PS2Keyboard::ScanCodeSet kSet3 = PS2Keyboard::SCAN_CODE_SET_3;
+  EXPECT_EQ(0x1E, PS2Keyboard::scanCode(PS2Keyboard::KC_A, kSet1));
+  EXPECT_EQ(0x1C, PS2Keyboard::scanCode(PS2Keyboard::KC_A, kSet2));
+  EXPECT_EQ(0x1C, PS2Keyboard::scanCode(PS2Keyboard::KC_A, kSet3));
+  EXPECT_EQ(0xE047, PS2Keyboard::scanCode(PS2Keyboard::KC_HOME, kSet1));
+  EXPECT_EQ(0xE06C, PS2Keyboard::scanCode(PS2Keyboard::KC_HOME, kSet2));
+  EXPECT_EQ(0x83, PS2Keyboard::scanCode(PS2Keyboard::KC_F7, kSet2));
+  EXPECT_EQ(0xE027, PS2Keyboard::scanCode(PS2Keyboard::KC_RGUI, kSet2));
+  EXPECT_EQ(0x8B, PS2Keyboard::scanCode(PS2Keyboard::KC_LGUI, kSet3));
+  EXPECT_EQ(0, PS2Keyboard::scanCode(PS2Keyboard::KC_PAUSE, kSet2));
+  EXPECT_EQ(0x62, PS2Keyboard::scanCode(PS2Keyboard::KC_PAUSE, kSet3));
+  EXPECT_EQ(0, PS2Keyboard::scanCode(PS2Keyboard::KC_F13, kSet2));
+  EXPECT_EQ(0, PS2Keyboard::scanCode(PS2Keyboard::KC_INVALID, kSet2));
+}
+
+TEST_F(PS2KeyboardTests, ScanCodeRoundTrip) {
+  // Every key with a make code decodes back to itself, in all sets.
+  const PS2Keyboard::ScanCodeSet kSets[] = {PS2Keyboard::SCAN_CODE_SET_1,
+                                            PS2Keyboard::SCAN_CODE_SET_2,
+                                            PS2Keyboard::SCAN_CODE_SET_3};
+  int keys = 0;
+  for (size_t s = 0; s < numberof(kSets); ++s) {
+    keyboard_.setScanCodeSet(kSets[s]);
+    for (int kc = 0; kc < PS2Keyboard::KC_INVALID; ++kc) {
+      uint16_t code = PS2Keyboard::scanCode((PS2Keyboard::KeyCode)kc,
+                                            kSets[s]);
+      if (code == 0)
+        continue;
+      ++keys;
+      if (code > 0xFF)
+        keyboard_.processByteForTesting(code >> 8);
+      keyboard_.processByteForTesting(code & 0xFF);
+      EXPECT_EQ(1, keyboard_.available());
+      PS2Keyboard::Key k = keyboard_.read();
+      EXPECT_EQ(kc, k.code());
+      EXPECT_EQ(PS2Keyboard::KEY_PRESSED, k.type());
+    }
+  }
+  EXPECT_EQ(3 * 105, keys);
+}
+
 TEST_F(PS2KeyboardTests, Shift_Up) {
   // Press L_SHFT, press up arrow, release up arrow, release L_SHFT
   keyboard_.processByteForTesting(0x12);  // LSHFT pressed
@@ -0,0 +1,296 @@
+
+#include <unit_tests.h>
+
+#include "ps2_mouse.h"
+#include "ps2_mouse_manager.h"
+#include "ps2_protocol.h"
+#include "ps2_test_device.h"
+
+#define numberof(a) (sizeof(a)/sizeof((a)[0]))
+
+namespace {
+
+unsigned long g_clock;
+
+unsigned long TestClock() {
+  return g_clock;
+}
+
+}  // namespace
+
+class PS2MouseManagerBeginTests : public testing::TestCase {
+ protected:
+  PS2P_DECLARE(PS2MouseManagerBeginTests, protocol_);
+  PS2Mouse mouse_;
+  PS2MouseManager manager_;
+ private:
+  void SetUp() override {
+    EXPECT_TRUE(protocol_.begin(2, 3));
+    EXPECT_TRUE(mouse_.begin(&protocol_));
+  }
+};
+
+PS2P_IMPLEMENT(PS2MouseManagerBeginTests, protocol_);
+
+TEST_F(PS2MouseManagerBeginTests, Begin) {
+  EXPECT_TRUE(manager_.begin(&mouse_));
+  EXPECT_EQ(0, manager_.available());
+}
+
+TEST_F(PS2MouseManagerBeginTests, BeginWithNullMouse) {
+  EXPECT_FALSE(manager_.begin(0));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+class PS2MouseManagerTests : public testing::TestCase {
+ protected:
+  PS2MouseManagerTests() : device_(&protocol_) {}
+
+  // Sends the bytes queued with write(), then the responses.
+  void RunMouse() {
+    arduino::mock::ScopedDelayHook hook(&device_);
+    while (protocol_.writeStatus() == PS2Protocol::WRITE_PENDING) {
+      delayMicroseconds(50);
+      protocol_.poll();
+    }
+    while (device_.responding())
+      delay(1);
+  }
+
+  void ExpectWritten(const byte* bytes, int count) {
+    const std::deque<byte>& written = device_.written();
+    EXPECT_EQ(count, written.size());
+    for (int i = 0; i < count && i < written.size(); ++i)
+      EXPECT_EQ(bytes[i], written[i]);
+  }
+
+  PS2P_DECLARE(PS2MouseManagerTests, protocol_);
+  PS2Mouse mouse_;
+  PS2MouseManager manager_;
+  PS2TestDevice device_;
+ private:
+  void SetUp() override {
+    EXPECT_TRUE(protocol_.begin(2, 3));
+    EXPECT_TRUE(mouse_.begin(&protocol_));
+    EXPECT_TRUE(manager_.begin(&mouse_));
+    device_.begin();
+  }
+};
+
+PS2P_IMPLEMENT(PS2MouseManagerTests, protocol_);
+
+TEST_F(PS2MouseManagerTests, Report) {
+  // Left button, X = 5, Y = -3.
+  const byte packet[] = {0x29, 0x05, 0xFD};
+  device_.SendBytes(packet, numberof(packet));
+  EXPECT_EQ(1, manager_.available());
+
+  PS2MouseManager::Report report = manager_.read();
+  EXPECT_EQ(PS2Mouse::BUTTON_LEFT, report.buttons);
+  EXPECT_EQ(5, report.x);
+  EXPECT_EQ(3, report.y);
+  EXPECT_EQ(0, report.wheel);
+  EXPECT_TRUE(report.isButtonPressed(PS2Mouse::BUTTON_LEFT));
+  EXPECT_TRUE(manager_.isButtonPressed(PS2Mouse::BUTTON_LEFT));
+  EXPECT_FALSE(manager_.isButtonPressed(PS2Mouse::BUTTON_RIGHT));
+  EXPECT_EQ(0, manager_.available());
+
+  // The report is laid out as sent to the host.
+  const byte* data = report.data();
+  EXPECT_EQ(PS2Mouse::BUTTON_LEFT, data[0]);
+  EXPECT_EQ(5, data[1]);
+  EXPECT_EQ(3, data[2]);
+  EXPECT_EQ(0, data[3]);
+}
+
+TEST_F(PS2MouseManagerTests, SplitsLargeMotion) {
+  // Two packets of X = 200, merged by the mouse.
+  const byte packets[] = {0x08, 0xC8, 0x00,
+                          0x08, 0xC8, 0x00};
+  device_.SendBytes(packets, numberof(packets));
+  EXPECT_EQ(1, manager_.available());
+  EXPECT_EQ(127, manager_.read().x);
+
+  // The rest of the movement is in the next reports.
+  EXPECT_EQ(3, manager_.available());
+  EXPECT_EQ(127, manager_.read().x);
+  EXPECT_EQ(127, manager_.read().x);
+  EXPECT_EQ(19, manager_.read().x);
+  EXPECT_EQ(0, manager_.available());
+}
+
+TEST_F(PS2MouseManagerTests, SplitKeepsButtons) {
+  // Move with the left button down, then release it.
+  const byte packets[] = {0x19, 0x00, 0x00,
+                          0x08, 0x00, 0x00};
+  for (int i = 0; i < 2; ++i) {
+    device_.SendBytes(packets, 3);
+    EXPECT_EQ(1, manager_.available());
+  }
+  device_.SendBytes(packets + 3, 3);
+
+  // -512 needs five reports, all with the button down.
+  EXPECT_EQ(2, manager_.available());
+  for (int i = 0; i < 4; ++i) {
+    PS2MouseManager::Report report = manager_.read();
+    EXPECT_EQ(-127, report.x);
+    EXPECT_EQ(PS2Mouse::BUTTON_LEFT, report.buttons);
+  }
+  PS2MouseManager::Report report = manager_.read();
+  EXPECT_EQ(-4, report.x);
+  EXPECT_EQ(PS2Mouse::BUTTON_LEFT, report.buttons);
+
+  report = manager_.read();
+  EXPECT_EQ(0, report.x);
+  EXPECT_EQ(0, report.buttons);
+  EXPECT_EQ(0, manager_.available());
+}
+
+TEST_F(PS2MouseManagerTests, PollIntervalKeepsClicks) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  manager_.setPollInterval(8);
+
+  // A click and some movement within one poll interval.
+  const byte packets[] = {0x09, 0x00, 0x00,
+                          0x08, 0x02, 0x00,
+                          0x08, 0x03, 0x00};
+  device_.SendBytes(packets, numberof(packets));
+  EXPECT_EQ(1, manager_.available());
+  PS2MouseManager::Report report = manager_.read();
+  EXPECT_EQ(PS2Mouse::BUTTON_LEFT, report.buttons);
+  EXPECT_EQ(0, report.x);
+
+  // The release waits for the next interval, with the movement merged.
+  EXPECT_EQ(0, manager_.available());
+  g_clock += 8;
+  EXPECT_EQ(1, manager_.available());
+  report = manager_.read();
+  EXPECT_EQ(0, report.buttons);
+  EXPECT_EQ(5, report.x);
+  g_clock += 8;
+  EXPECT_EQ(0, manager_.available());
+}
+
+TEST_F(PS2MouseManagerTests, Wheel) {
+  mouse_.setMouseType(PS2Mouse::MOUSE_WHEEL);
+  const byte packet[] = {0x08, 0x00, 0x00, 0x01};
+  device_.SendBytes(packet, numberof(packet));
+  EXPECT_EQ(1, manager_.available());
+  EXPECT_EQ(-1, manager_.read().wheel);
+}
+
+TEST_F(PS2MouseManagerTests, ResetMouse) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  const byte responses[] = {0xFA, 0xAA, 0x00,
+                            0xFA, 0xFA, 0xFA, 0xFA, 0xFA, 0xFA, 0xFA, 0x00};
+  device_.Respond(responses, numberof(responses));
+  EXPECT_TRUE(manager_.resetMouse());
+  EXPECT_EQ(PS2Mouse::MOUSE_STANDARD, mouse_.getMouseType());
+  EXPECT_EQ(100, manager_.getSampleRate());
+  EXPECT_EQ(2, manager_.getResolution());
+
+  const byte expected[] = {0xFF,
+                           0xF3, 200, 0xF3, 100, 0xF3, 80, 0xF2,
+                           0xF3, 100, 0xF4};
+  ExpectWritten(expected, numberof(expected));
+
+  // The ACKs of the last commands are not taken for packets.
+  const byte acks[] = {0xFA, 0xFA, 0xFA};
+  device_.Respond(acks, numberof(acks));
+  RunMouse();
+  EXPECT_EQ(0, manager_.available());
+}
+
+TEST_F(PS2MouseManagerTests, ResetMouseSelfTestFails) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  const byte responses[] = {0xFA, 0xFC};
+  device_.Respond(responses, numberof(responses));
+  EXPECT_FALSE(manager_.resetMouse());
+}
+
+TEST_F(PS2MouseManagerTests, SetSampleRate) {
+  EXPECT_TRUE(manager_.setSampleRate(40));
+  EXPECT_EQ(40, manager_.getSampleRate());
+
+  // Only one command at a time.
+  EXPECT_FALSE(manager_.setResolution(3));
+  EXPECT_EQ(2, manager_.getResolution());
+
+  const byte acks[] = {0xFA, 0xFA, 0xFA, 0xFA};
+  device_.Respond(acks, numberof(acks));
+  RunMouse();
+  const byte expected[] = {0xF5, 0xF3, 40, 0xF4};
+  ExpectWritten(expected, numberof(expected));
+  EXPECT_EQ(0, manager_.available());
+
+  // Packets are decoded as usual after the ACKs.
+  const byte packet[] = {0x08, 0x01, 0x00};
+  device_.SendBytes(packet, numberof(packet));
+  EXPECT_EQ(1, manager_.available());
+  EXPECT_EQ(1, manager_.read().x);
+}
+
+TEST_F(PS2MouseManagerTests, SetResolution) {
+  EXPECT_TRUE(manager_.setResolution(3));
+  EXPECT_EQ(3, manager_.getResolution());
+  RunMouse();
+  const byte expected[] = {0xF5, 0xE8, 3, 0xF4};
+  ExpectWritten(expected, numberof(expected));
+}
+
+TEST_F(PS2MouseManagerTests, AdaptiveRateRaises) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  manager_.setAdaptiveRate(200);
+
+  const byte packet[] = {0x08, 0x01, 0x00};
+  device_.SendBytes(packet, numberof(packet));
+  EXPECT_EQ(1, manager_.available());
+  manager_.read();
+
+  g_clock += 1000;
+  EXPECT_EQ(0, manager_.available());
+  EXPECT_EQ(200, manager_.getSampleRate());
+  RunMouse();
+  const byte expected[] = {0xF5, 0xF3, 200, 0xF4};
+  ExpectWritten(expected, numberof(expected));
+
+  // Already at the highest rate allowed.
+  device_.SendBytes(packet, numberof(packet));
+  EXPECT_EQ(1, manager_.available());
+  g_clock += 1000;
+  manager_.available();
+  EXPECT_EQ(200, manager_.getSampleRate());
+  EXPECT_EQ(0, protocol_.writePending());
+}
+
+TEST_F(PS2MouseManagerTests, AdaptiveRateStaysWhenIdle) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  manager_.setAdaptiveRate(200);
+
+  g_clock += 1000;
+  EXPECT_EQ(0, manager_.available());
+  EXPECT_EQ(100, manager_.getSampleRate());
+  EXPECT_EQ(0, protocol_.writePending());
+}
+
+TEST_F(PS2MouseManagerTests, AdaptiveRateLowersOnBacklog) {
+  g_clock = 1000;
+  manager_.setClock(TestClock);
+  manager_.setAdaptiveRate(200);
+
+  // More than half of the protocol buffer waits to be read.
+  const byte packet[] = {0x08, 0x01, 0x00};
+  for (int i = 0; i < PS2Protocol::kBufferSize / 2 / 3 + 1; ++i)
+    device_.SendBytes(packet, numberof(packet));
+
+  g_clock += 1000;
+  EXPECT_EQ(1, manager_.available());
+  EXPECT_EQ(60, manager_.getSampleRate());
+  RunMouse();
+  const byte expected[] = {0xF5, 0xF3, 60, 0xF4};
+  ExpectWritten(expected, numberof(expected));
+}
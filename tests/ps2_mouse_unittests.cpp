@@ -0,0 +1,307 @@
+
+#include <unit_tests.h>
+
+#include "ps2_mouse.h"
+#include "ps2_protocol.h"
+#include "ps2_test_device.h"
+
+#define numberof(a) (sizeof(a)/sizeof((a)[0]))
+
+class PS2MouseBeginTests : public testing::TestCase {
+ protected:
+  PS2P_DECLARE(PS2MouseBeginTests, protocol_);
+  PS2Mouse mouse_;
+ private:
+  void SetUp() override {
+    EXPECT_TRUE(protocol_.begin(2, 3));
+  }
+};
+
+PS2P_IMPLEMENT(PS2MouseBeginTests, protocol_);
+
+TEST_F(PS2MouseBeginTests, Begin) {
+  EXPECT_TRUE(mouse_.begin(&protocol_));
+  EXPECT_EQ(PS2Mouse::MOUSE_STANDARD, mouse_.getMouseType());
+  EXPECT_EQ(0, mouse_.available());
+}
+
+TEST_F(PS2MouseBeginTests, BeginWithNullProtocol) {
+  EXPECT_FALSE(mouse_.begin(0));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+class PS2MouseTests : public testing::TestCase {
+ protected:
+  PS2MouseTests() : device_(&protocol_) {}
+
+  // Responds to one sample rate sequence of enableExtensions() with |id|.
+  void RespondWithId(byte id) {
+    const byte bytes[] = {0xFA, 0xFA, 0xFA, 0xFA, 0xFA, 0xFA, 0xFA, id};
+    device_.Respond(bytes, numberof(bytes));
+  }
+
+  PS2P_DECLARE(PS2MouseTests, protocol_);
+  PS2Mouse mouse_;
+  PS2TestDevice device_;
+ private:
+  void SetUp() override {
+    EXPECT_TRUE(protocol_.begin(2, 3));
+    EXPECT_TRUE(mouse_.begin(&protocol_));
+    device_.begin();
+  }
+};
+
+PS2P_IMPLEMENT(PS2MouseTests, protocol_);
+
+TEST_F(PS2MouseTests, Empty) {
+  EXPECT_EQ(0, mouse_.available());
+}
+
+TEST_F(PS2MouseTests, StandardPacket) {
+  // Left button, X = 5, Y = -3.
+  const byte packet[] = {0x29, 0x05, 0xFD};
+  device_.SendBytes(packet, 2);
+  EXPECT_EQ(0, mouse_.available());
+  device_.SendBytes(packet + 2, 1);
+  EXPECT_EQ(1, mouse_.available());
+
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(5, event.x);
+  EXPECT_EQ(-3, event.y);
+  EXPECT_EQ(0, event.wheel);
+  EXPECT_EQ(PS2Mouse::BUTTON_LEFT, event.buttons);
+  EXPECT_EQ(0, mouse_.available());
+}
+
+TEST_F(PS2MouseTests, MotionIsMerged) {
+  const byte packets[] = {0x08, 0x05, 0x01,
+                          0x08, 0x07, 0x02,
+                          0x18, 0xFE, 0x03};
+  device_.SendBytes(packets, numberof(packets));
+  EXPECT_EQ(1, mouse_.available());
+
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(10, event.x);
+  EXPECT_EQ(6, event.y);
+  EXPECT_EQ(0, event.buttons);
+}
+
+TEST_F(PS2MouseTests, ButtonChangeStartsEvent) {
+  // Move, press the right button, move, then release it.
+  const byte packets[] = {0x08, 0x01, 0x00,
+                          0x0A, 0x00, 0x00,
+                          0x0A, 0x02, 0x00,
+                          0x08, 0x00, 0x00};
+  device_.SendBytes(packets, numberof(packets));
+  EXPECT_EQ(3, mouse_.available());
+
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(1, event.x);
+  EXPECT_EQ(0, event.buttons);
+  event = mouse_.read();
+  EXPECT_EQ(2, event.x);
+  EXPECT_EQ(PS2Mouse::BUTTON_RIGHT, event.buttons);
+  event = mouse_.read();
+  EXPECT_EQ(0, event.x);
+  EXPECT_EQ(0, event.buttons);
+  EXPECT_EQ(0, mouse_.available());
+}
+
+TEST_F(PS2MouseTests, MotionSaturates) {
+  // 200 packets of X = -255 and Y = 255.
+  const byte packet[] = {0x18, 0x01, 0xFF};
+  for (int i = 0; i < 200; ++i) {
+    device_.SendBytes(packet, numberof(packet));
+    EXPECT_EQ(1, mouse_.available());
+  }
+
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(-32768, event.x);
+  EXPECT_EQ(32767, event.y);
+}
+
+TEST_F(PS2MouseTests, RealignsAfterLostByte) {
+  // The first byte of the first packet is lost, and the two bytes left do
+  // not have the sync bit set.
+  const byte packets[] = {0x01, 0x02,
+                          0x08, 0x03, 0x04};
+  device_.SendBytes(packets, numberof(packets));
+  EXPECT_EQ(1, mouse_.available());
+  EXPECT_EQ(2, mouse_.getSyncErrors());
+
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(3, event.x);
+  EXPECT_EQ(4, event.y);
+}
+
+TEST_F(PS2MouseTests, WheelPacket) {
+  mouse_.setMouseType(PS2Mouse::MOUSE_WHEEL);
+  const byte packets[] = {0x0C, 0x00, 0x00, 0xFF,
+                          0x0C, 0x00, 0x00, 0xFE};
+  device_.SendBytes(packets, numberof(packets));
+  EXPECT_EQ(1, mouse_.available());
+
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(-3, event.wheel);
+  EXPECT_EQ(PS2Mouse::BUTTON_MIDDLE, event.buttons);
+}
+
+TEST_F(PS2MouseTests, WheelSaturates) {
+  mouse_.setMouseType(PS2Mouse::MOUSE_WHEEL);
+  const byte packet[] = {0x08, 0x00, 0x00, 0x64};
+  device_.SendBytes(packet, numberof(packet));
+  device_.SendBytes(packet, numberof(packet));
+  EXPECT_EQ(1, mouse_.available());
+  EXPECT_EQ(127, mouse_.read().wheel);
+}
+
+TEST_F(PS2MouseTests, FiveButtonPacket) {
+  mouse_.setMouseType(PS2Mouse::MOUSE_FIVE_BUTTONS);
+  // Button 4 with the wheel at -1, then buttons 4 and 5 with the wheel at 7.
+  const byte packets[] = {0x08, 0x00, 0x00, 0x1F,
+                          0x08, 0x00, 0x00, 0x37};
+  device_.SendBytes(packets, numberof(packets));
+  EXPECT_EQ(2, mouse_.available());
+
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(-1, event.wheel);
+  EXPECT_EQ(PS2Mouse::BUTTON_4, event.buttons);
+  event = mouse_.read();
+  EXPECT_EQ(7, event.wheel);
+  EXPECT_EQ(PS2Mouse::BUTTON_4 | PS2Mouse::BUTTON_5, event.buttons);
+}
+
+TEST_F(PS2MouseTests, FiveButtonPacketOutOfSync) {
+  mouse_.setMouseType(PS2Mouse::MOUSE_FIVE_BUTTONS);
+  const byte packets[] = {0x08, 0x00, 0x00, 0x48,
+                          0x00, 0x00, 0x01};
+  device_.SendBytes(packets, numberof(packets));
+  EXPECT_EQ(1, mouse_.available());
+  EXPECT_EQ(1, mouse_.getSyncErrors());
+
+  // The last byte of the bad packet starts the next one.
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(1, event.wheel);
+  EXPECT_EQ(0, event.buttons);
+}
+
+TEST_F(PS2MouseTests, BufferFullMergesButtons) {
+  // Toggle the left button more times than the buffer can hold.
+  const byte press[] = {0x09, 0x01, 0x00};
+  const byte release[] = {0x08, 0x01, 0x00};
+  for (int i = 0; i < PS2Mouse::kBufferSize + 1; ++i) {
+    device_.SendBytes(i % 2 ? release : press, 3);
+    mouse_.available();
+  }
+  device_.SendBytes(PS2Mouse::kBufferSize % 2 ? press : release, 3);
+  EXPECT_EQ(PS2Mouse::kBufferSize + 1, mouse_.available());
+
+  for (int i = 0; i < PS2Mouse::kBufferSize; ++i) {
+    PS2Mouse::Event event = mouse_.read();
+    EXPECT_EQ(1, event.x);
+  }
+
+  // The last two packets are merged.
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(2, event.x);
+}
+
+#if PS2_TIMESTAMPS
+TEST_F(PS2MouseTests, Timestamp) {
+  arduino::mock::SetMicros(0x10000);
+  const byte packet[] = {0x08, 0x01, 0x00};
+  device_.SendBytes(packet, numberof(packet));
+  arduino::mock::AdvanceMicros(0x1000);
+  device_.SendBytes(packet, numberof(packet));
+
+  // Merged events have the time of their first packet.
+  EXPECT_EQ(1, mouse_.available());
+  EXPECT_EQ(PS2Timestamp::fromMicros(0x10000), mouse_.read().timestamp);
+}
+#endif
+
+TEST_F(PS2MouseTests, EnableExtensionsFiveButtons) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  RespondWithId(PS2Mouse::MOUSE_WHEEL);
+  RespondWithId(PS2Mouse::MOUSE_FIVE_BUTTONS);
+  EXPECT_EQ(PS2Mouse::MOUSE_FIVE_BUTTONS, mouse_.enableExtensions());
+  EXPECT_EQ(PS2Mouse::MOUSE_FIVE_BUTTONS, mouse_.getMouseType());
+
+  const byte expected[] = {0xF3, 200, 0xF3, 100, 0xF3, 80, 0xF2,
+                           0xF3, 200, 0xF3, 200, 0xF3, 80, 0xF2};
+  EXPECT_EQ(numberof(expected), device_.written().size());
+  for (int i = 0; i < numberof(expected) && i < device_.written().size(); ++i)
+    EXPECT_EQ(expected[i], device_.written()[i]);
+}
+
+TEST_F(PS2MouseTests, EnableExtensionsWheel) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  RespondWithId(PS2Mouse::MOUSE_WHEEL);
+  RespondWithId(PS2Mouse::MOUSE_WHEEL);
+  EXPECT_EQ(PS2Mouse::MOUSE_WHEEL, mouse_.enableExtensions());
+  EXPECT_EQ(PS2Mouse::MOUSE_WHEEL, mouse_.getMouseType());
+}
+
+TEST_F(PS2MouseTests, EnableExtensionsStandard) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  RespondWithId(PS2Mouse::MOUSE_STANDARD);
+  EXPECT_EQ(PS2Mouse::MOUSE_STANDARD, mouse_.enableExtensions());
+  EXPECT_EQ(7, device_.written().size());
+}
+
+TEST_F(PS2MouseTests, EnableExtensionsNoResponse) {
+  arduino::mock::ScopedDelayHook hook(&device_);
+  const byte acks[] = {0xFA, 0xFA, 0xFA, 0xFA, 0xFA, 0xFA, 0xFA};
+  device_.Respond(acks, numberof(acks));
+  EXPECT_EQ(PS2Mouse::MOUSE_STANDARD, mouse_.enableExtensions());
+}
+
+TEST_F(PS2MouseTests, ExpectAcks) {
+  // A partial packet is abandoned when the host sends a command.
+  const byte partial[] = {0x08, 0x05};
+  device_.SendBytes(partial, numberof(partial));
+  mouse_.expectAcks(2);
+
+  const byte bytes[] = {0xFA, 0xFA,
+                        0xFA, 0x01, 0x02};
+  device_.SendBytes(bytes, numberof(bytes));
+  EXPECT_EQ(1, mouse_.available());
+  EXPECT_EQ(0, mouse_.getSyncErrors());
+
+  // Only the expected ACKs are dropped, the third 0xFA starts a packet.
+  PS2Mouse::Event event = mouse_.read();
+  EXPECT_EQ(-255, event.x);
+  EXPECT_EQ(-254, event.y);
+  EXPECT_EQ(PS2Mouse::BUTTON_RIGHT, event.buttons);
+}
+
+TEST_F(PS2MouseTests, AckValueInsidePacket) {
+  mouse_.expectAcks(2);
+  const byte ack[] = {0xFA};
+  device_.SendBytes(ack, numberof(ack));
+
+  // With an ACK still expected, 0xFA inside a packet is a movement of -6.
+  const byte packet[] = {0x18, 0xFA, 0x00};
+  device_.SendBytes(packet, numberof(packet));
+  EXPECT_EQ(1, mouse_.available());
+  EXPECT_EQ(-6, mouse_.read().x);
+  EXPECT_EQ(0, mouse_.getSyncErrors());
+}
+
+TEST_F(PS2MouseTests, FailedCommandForgetsAcks) {
+  // The mouse never clocks the command in, so the write times out.
+  mouse_.expectAcks(4);
+  EXPECT_TRUE(protocol_.write(0xF5));
+  arduino::mock::AdvanceMicros(200);
+  EXPECT_EQ(0, mouse_.available());
+  arduino::mock::AdvanceMicros(20000);
+  EXPECT_EQ(0, mouse_.available());
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, protocol_.writeStatus());
+
+  // A packet starting with 0xFA is no longer taken for an ACK.
+  const byte packet[] = {0xFA, 0x00, 0x00};
+  device_.SendBytes(packet, numberof(packet));
+  EXPECT_EQ(1, mouse_.available());
+  EXPECT_EQ(PS2Mouse::BUTTON_RIGHT, mouse_.read().buttons);
+}
@@ -0,0 +1,166 @@
+
+#include <unit_tests.h>
+
+#include "ps2_pin_change.h"
+#include "ps2_protocol.h"
+
+// Two devices on pin change group 1, with the clock and data pins on the
+// same port.
+static const uint8_t kGroup = 1;
+static const uint8_t kClockA = 8;
+static const uint8_t kClockB = 9;
+static const uint8_t kDataA = 12;
+static const uint8_t kDataB = 13;
+
+// Defines no vectors here, there are no AVR interrupts to bind, but enables
+// the backend as a sketch would.
+PS2_PIN_CHANGE_VECTORS();
+
+class PS2PinChangeTests : public testing::TestCase {
+ protected:
+  // Returns bit |i| of the frame that sends |b|, from the start bit to the
+  // stop bit.
+  static int FrameBit(byte b, int i) {
+    if (i == 0)
+      return LOW;
+    if (i <= 8)
+      return (b >> (i - 1)) & 1;
+    if (i == 9) {
+      int parity = 1;
+      for (int j = 0; j < 8; ++j)
+        parity ^= (b >> j) & 1;
+      return parity;
+    }
+    return HIGH;
+  }
+
+  // Clocks one bit out of each device whose bit is not negative, as the
+  // devices would, calling the ISR handler of the group after each change of
+  // the pins.  The clocks of both devices fall at the same time.
+  void ClockBits(int bit_a, int bit_b) {
+    if (bit_a >= 0)
+      digitalWrite(kDataA, bit_a);
+    if (bit_b >= 0)
+      digitalWrite(kDataB, bit_b);
+    PS2PinChange::isrHandler(kGroup);
+
+    if (bit_a >= 0)
+      digitalWrite(kClockA, LOW);
+    if (bit_b >= 0)
+      digitalWrite(kClockB, LOW);
+    PS2PinChange::isrHandler(kGroup);
+
+    digitalWrite(kClockA, HIGH);
+    digitalWrite(kClockB, HIGH);
+    PS2PinChange::isrHandler(kGroup);
+  }
+
+  // Sends |a| from device A and |b| from device B, bit for bit together.
+  // Negative values leave the device idle.
+  void SendBytes(int a, int b) {
+    for (int i = 0; i < 11; ++i)
+      ClockBits(a < 0 ? -1 : FrameBit(a, i), b < 0 ? -1 : FrameBit(b, i));
+  }
+
+  PS2P_DECLARE(PS2PinChangeTests, protocol_a_);
+  PS2P_DECLARE(PS2PinChangeTests, protocol_b_);
+  PS2P_DECLARE(PS2PinChangeTests, protocol_c_);
+};
+
+PS2P_IMPLEMENT(PS2PinChangeTests, protocol_a_);
+PS2P_IMPLEMENT(PS2PinChangeTests, protocol_b_);
+PS2P_IMPLEMENT(PS2PinChangeTests, protocol_c_);
+
+TEST_F(PS2PinChangeTests, Begin) {
+  EXPECT_TRUE(protocol_a_.begin(kClockA, kDataA));
+  EXPECT_EQ(1 << kGroup, PCICR);
+  EXPECT_EQ(0x01, PCMSK1);
+
+  EXPECT_TRUE(protocol_b_.begin(kClockB, kDataB));
+  EXPECT_EQ(0x03, PCMSK1);
+
+  // Pins with an external interrupt keep using it.
+  EXPECT_TRUE(protocol_c_.begin(2, 3));
+  EXPECT_EQ(0, PCMSK0);
+}
+
+TEST_F(PS2PinChangeTests, BeginSameClockPin) {
+  EXPECT_TRUE(protocol_a_.begin(kClockA, kDataA));
+  EXPECT_FALSE(protocol_b_.begin(kClockA, kDataB));
+  EXPECT_EQ(0x01, PCMSK1);
+}
+
+TEST_F(PS2PinChangeTests, End) {
+  EXPECT_TRUE(protocol_a_.begin(kClockA, kDataA));
+  EXPECT_TRUE(protocol_b_.begin(kClockB, kDataB));
+
+  protocol_a_.end();
+  EXPECT_EQ(0x02, PCMSK1);
+  EXPECT_EQ(1 << kGroup, PCICR);
+
+  // The group is disabled with its last pin.
+  protocol_b_.end();
+  EXPECT_EQ(0, PCMSK1);
+  EXPECT_EQ(0, PCICR);
+}
+
+TEST_F(PS2PinChangeTests, OnlyFallingClockEdges) {
+  EXPECT_TRUE(protocol_a_.begin(kClockA, kDataA));
+
+  // Changes of the data pin and rising clock edges are ignored.
+  digitalWrite(kDataA, LOW);
+  PS2PinChange::isrHandler(kGroup);
+  digitalWrite(kDataA, HIGH);
+  PS2PinChange::isrHandler(kGroup);
+  EXPECT_EQ(0, protocol_a_.getClockPulsesForTesting());
+
+  digitalWrite(kClockA, LOW);
+  PS2PinChange::isrHandler(kGroup);
+  EXPECT_EQ(1, protocol_a_.getClockPulsesForTesting());
+  PS2PinChange::isrHandler(kGroup);
+  digitalWrite(kClockA, HIGH);
+  PS2PinChange::isrHandler(kGroup);
+  EXPECT_EQ(1, protocol_a_.getClockPulsesForTesting());
+}
+
+TEST_F(PS2PinChangeTests, SharedIsr) {
+  EXPECT_TRUE(protocol_a_.begin(kClockA, kDataA));
+  EXPECT_TRUE(protocol_b_.begin(kClockB, kDataB));
+
+  // Both devices clock at the same time.
+  SendBytes(0x1C, 0x55);
+  EXPECT_EQ(1, protocol_a_.available());
+  EXPECT_EQ(0x1C, protocol_a_.read());
+  EXPECT_EQ(1, protocol_b_.available());
+  EXPECT_EQ(0x55, protocol_b_.read());
+
+  // One device at a time.
+  SendBytes(0xAA, -1);
+  SendBytes(-1, 0xF0);
+  EXPECT_EQ(1, protocol_a_.available());
+  EXPECT_EQ(0xAA, protocol_a_.read());
+  EXPECT_EQ(1, protocol_b_.available());
+  EXPECT_EQ(0xF0, protocol_b_.read());
+}
+
+TEST_F(PS2PinChangeTests, RequestToSend) {
+  EXPECT_TRUE(protocol_a_.begin(kClockA, kDataA));
+
+  // The clock pin is detached while the host holds the clock low.
+  EXPECT_TRUE(protocol_a_.write(0xF4));
+  EXPECT_EQ(0, PCMSK1);
+  EXPECT_EQ(LOW, digitalRead(kClockA));
+
+  // Releasing the clock raises an interrupt for the rising edge.
+  arduino::mock::AdvanceMicros(200);
+  protocol_a_.poll();
+  EXPECT_EQ(0x01, PCMSK1);
+  EXPECT_EQ(HIGH, digitalRead(kClockA));
+  PS2PinChange::isrHandler(kGroup);
+  EXPECT_EQ(PS2Protocol::WAIT_S_DATA0, protocol_a_.getStateForTesting());
+
+  // The device clocks the bits in.
+  digitalWrite(kClockA, LOW);
+  PS2PinChange::isrHandler(kGroup);
+  EXPECT_EQ(PS2Protocol::WAIT_S_DATA1, protocol_a_.getStateForTesting());
+}
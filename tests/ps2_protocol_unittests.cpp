@@ -1,8 +1,10 @@
 
 #include <iostream>
+#include <vector>
 #include <unit_tests.h>
 
 #include "ps2_protocol.h"
+#include "ps2_test_device.h"
 
 // This is here to test the global macro.  The variables are not used.
 namespace {
@@ -10,6 +12,42 @@ PS2P_GLOBAL(dummy);
 PS2P_GLOBAL(toto);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Test the pin I/O policy used by the ISR handler.
+
+TEST(PinIOReadsPin) {
+  PS2PinIO pin;
+  pin.begin(13);
+  digitalWrite(13, HIGH);
+  EXPECT_EQ(HIGH, pin.read());
+  digitalWrite(13, LOW);
+  EXPECT_EQ(LOW, pin.read());
+}
+
+TEST(PinIOWritesPin) {
+  PS2PinIO pin;
+  pin.begin(13);
+  pin.setOutput();
+  EXPECT_EQ(OUTPUT, arduino::mock::GetPinMode(13));
+  pin.write(HIGH);
+  EXPECT_EQ(HIGH, digitalRead(13));
+  pin.write(LOW);
+  EXPECT_EQ(LOW, digitalRead(13));
+
+  // Other pins of the same port are left alone.
+  EXPECT_EQ(INPUT, arduino::mock::GetPinMode(12));
+  EXPECT_EQ(INPUT, arduino::mock::GetPinMode(14));
+}
+
+TEST(PinIOSetInputPullup) {
+  PS2PinIO pin;
+  pin.begin(13);
+  pinMode(13, OUTPUT);
+  pin.setInputPullup();
+  EXPECT_EQ(INPUT_PULLUP, arduino::mock::GetPinMode(13));
+  EXPECT_EQ(HIGH, digitalRead(13));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Test the begin() method.
 
@@ -34,15 +72,71 @@ TEST_F(PS2ProtocolBeginTests, BeginSamePin) {
 }
 
 TEST_F(PS2ProtocolBeginTests, BeginClockSupportsIsr) {
-  // The arduino mock framework supports interrupts only on pins 2 and 3,
-  // so for this test I just make sure to use a pin other than those.
-  EXPECT_FALSE(protocol_.begin(4, 3));
+  // The arduino mock framework supports external interrupts only on pins 2
+  // and 3, and pin change interrupts only on pins below 24, so for this test
+  // I just make sure to use a pin other than those.
+  EXPECT_FALSE(protocol_.begin(24, 3));
 }
 
 TEST_F(PS2ProtocolBeginTests, NoneAvailable) {
   EXPECT_TRUE(protocol_.begin(2, 3));
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Test the ISR handlers bound by begin() for objects declared without the
+// macros.
+
+TEST(PS2ProtocolArray) {
+  PS2Protocol protocols[2];
+  EXPECT_TRUE(protocols[0].begin(2, 4));
+  EXPECT_TRUE(protocols[1].begin(3, 5));
+
+  // Each interrupt reaches its own object.
+  RaiseFrame(0, 4, 0x1C);
+  RaiseFrame(1, 5, 0xAA);
+  EXPECT_EQ(1, protocols[0].available());
+  EXPECT_EQ(0x1C, protocols[0].read());
+  EXPECT_EQ(1, protocols[1].available());
+  EXPECT_EQ(0xAA, protocols[1].read());
+  EXPECT_EQ(11, protocols[0].getClockPulsesForTesting());
+  EXPECT_EQ(11, protocols[1].getClockPulsesForTesting());
+}
+
+TEST(PS2ProtocolBindSameInterrupt) {
+  PS2Protocol first;
+  PS2Protocol second;
+  EXPECT_TRUE(first.begin(2, 4));
+  EXPECT_FALSE(second.begin(2, 5));
+
+  // The interrupt is free again once the first object ends.
+  first.end();
+  EXPECT_TRUE(second.begin(2, 5));
+  RaiseFrame(0, 5, 0x55);
+  EXPECT_EQ(0, first.available());
+  EXPECT_EQ(1, second.available());
+}
+
+TEST(PS2ProtocolBindAfterWrite) {
+  // The handler is attached again after each request-to-send.
+  PS2Protocol protocol;
+  EXPECT_TRUE(protocol.begin(2, 4));
+  EXPECT_TRUE(protocol.write(0xF4));
+  arduino::mock::RaiseInterrupt(0);
+  EXPECT_EQ(0, protocol.getClockPulsesForTesting());
+
+  arduino::mock::AdvanceMicros(200);
+  protocol.poll();
+  arduino::mock::RaiseInterrupt(0);
+  EXPECT_EQ(1, protocol.getClockPulsesForTesting());
+  EXPECT_EQ(PS2Protocol::WAIT_S_DATA1, protocol.getStateForTesting());
+}
+
+TEST(PS2ProtocolPinChangeWithoutMacros) {
+  PS2Protocol protocol;
+  EXPECT_TRUE(protocol.begin(8, 12));
+  EXPECT_EQ(0x01, PCMSK1);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Test the ISR handler when receiving bytes from the device.
 
@@ -110,6 +204,92 @@ TEST_F(PS2ProtocolReceiveTests, BadStopBit) {
   EXPECT_EQ(0, protocol_.available());
 }
 
+TEST_F(PS2ProtocolReceiveTests, AllByteValues) {
+  for (int i = 0; i < 256; ++i) {
+    SendByte(i);
+    EXPECT_EQ(1, protocol_.available());
+    EXPECT_EQ(i, protocol_.read());
+    // Even parity is always wrong.
+    int ones = 0;
+    for (int b = i; b; b >>= 1)
+      ones += b & 1;
+    SendByte(0, i, ones & 1, 1);
+    EXPECT_EQ(0, protocol_.available());
+  }
+}
+
+TEST_F(PS2ProtocolReceiveTests, StateAdvancesWithEachBit) {
+  protocol_.callIsrHandlerForTesting(LOW);
+  EXPECT_EQ(PS2Protocol::WAIT_R_DATA0, protocol_.getStateForTesting());
+  for (int i = 0; i < 8; ++i)
+    protocol_.callIsrHandlerForTesting(HIGH);
+  EXPECT_EQ(PS2Protocol::WAIT_R_PARITY, protocol_.getStateForTesting());
+  protocol_.callIsrHandlerForTesting(HIGH);
+  EXPECT_EQ(PS2Protocol::WAIT_R_STOP, protocol_.getStateForTesting());
+  protocol_.callIsrHandlerForTesting(HIGH);
+  EXPECT_EQ(PS2Protocol::WAIT_R_START, protocol_.getStateForTesting());
+  EXPECT_EQ(0xFF, protocol_.read());
+}
+
+TEST_F(PS2ProtocolReceiveTests, MissedEdgeResynchronizes) {
+  // Only part of a frame is seen, as if clock edges were missed.
+  protocol_.callIsrHandlerForTesting(LOW);
+  protocol_.callIsrHandlerForTesting(HIGH);
+  protocol_.callIsrHandlerForTesting(LOW);
+  EXPECT_EQ(PS2Protocol::WAIT_R_DATA2, protocol_.getStateForTesting());
+
+  arduino::mock::AdvanceMicros(1000);
+  SendByte(0x12);
+  EXPECT_EQ(PS2Protocol::WAIT_R_START, protocol_.getStateForTesting());
+  EXPECT_EQ(1, protocol_.getResyncs());
+  EXPECT_EQ(1, protocol_.available());
+  EXPECT_EQ(0x12, protocol_.read());
+}
+
+TEST_F(PS2ProtocolReceiveTests, SlowClockDoesNotResynchronize) {
+  // Send 0x01 with 100 microseconds between bits, the slowest PS2 clock.
+  const int bits[] = {LOW, HIGH, LOW, LOW, LOW, LOW, LOW, LOW, LOW, LOW, HIGH};
+  for (int i = 0; i < 11; ++i) {
+    arduino::mock::AdvanceMicros(100);
+    protocol_.callIsrHandlerForTesting(bits[i]);
+  }
+  EXPECT_EQ(0, protocol_.getResyncs());
+  EXPECT_EQ(1, protocol_.available());
+  EXPECT_EQ(0x01, protocol_.read());
+}
+
+TEST_F(PS2ProtocolReceiveTests, IdleLineDoesNotResynchronize) {
+  SendByte(0x12);
+  arduino::mock::AdvanceMicros(100000);
+  SendByte(0x34);
+  EXPECT_EQ(0, protocol_.getResyncs());
+  EXPECT_EQ(2, protocol_.available());
+}
+
+#if PS2_TIMESTAMPS
+TEST_F(PS2ProtocolReceiveTests, Timestamp) {
+  arduino::mock::SetMicros(0x10000);
+  SendByte(0x12);
+  arduino::mock::AdvanceMicros(0x1000);
+  SendByte(0x34);
+  arduino::mock::AdvanceMicros(0x8000);
+
+  EXPECT_EQ(0x12, protocol_.read());
+  EXPECT_EQ(0x10000, PS2Timestamp::expand(protocol_.lastTimestamp(),
+                                          micros()));
+  EXPECT_EQ(0x34, protocol_.read());
+  EXPECT_EQ(0x11000, PS2Timestamp::expand(protocol_.lastTimestamp(),
+                                          micros()));
+}
+#endif
+
+TEST(PS2TimestampExpandWrapsAround) {
+  // The truncated timestamp wraps around between the event and expand().
+  unsigned long event = 0x0FF00;
+  byte timestamp = PS2Timestamp::fromMicros(event);
+  EXPECT_EQ(event, PS2Timestamp::expand(timestamp, 0x10280));
+}
+
 TEST_F(PS2ProtocolReceiveTests, Buffer) {
   for (int i = 0; i < PS2Protocol::kBufferSize; ++i) {
     EXPECT_EQ(i, protocol_.available());
@@ -136,6 +316,84 @@ TEST_F(PS2ProtocolReceiveTests, BufferOverflow) {
   }
 }
 
+TEST_F(PS2ProtocolReceiveTests, IsrReadsDataPin) {
+  // Drive the data pin and let the real ISR handler read it.
+  const int bits[] = {LOW, LOW, HIGH, LOW, LOW, HIGH, LOW, LOW, LOW, HIGH, HIGH};
+  for (int i = 0; i < 11; ++i) {
+    digitalWrite(3, bits[i]);
+    protocol_.isrHandlerImpl();
+  }
+  EXPECT_EQ(1, protocol_.available());
+  EXPECT_EQ(0x12, protocol_.read());
+}
+
+TEST_F(PS2ProtocolReceiveTests, BufferWrapsAround) {
+  // The buffer indices are free running bytes, so go around them a few times
+  // with the buffer partly full.
+  SendByte(0xAA);
+  for (int i = 0; i < 600; ++i) {
+    SendByte(i);
+    EXPECT_EQ(2, protocol_.available());
+    EXPECT_EQ(i == 0 ? 0xAA : (byte)(i - 1), protocol_.read());
+  }
+}
+
+namespace {
+
+struct FrameLog {
+  FrameLog() : count(0) {}
+  int count;
+  byte bytes[4];
+  byte timestamps[4];
+};
+
+void LogFrame(void* context, byte b, byte timestamp) {
+  FrameLog* log = static_cast<FrameLog*>(context);
+  if (log->count < 4) {
+    log->bytes[log->count] = b;
+    log->timestamps[log->count] = timestamp;
+  }
+  ++log->count;
+}
+
+}  // namespace
+
+TEST_F(PS2ProtocolReceiveTests, FrameCallback) {
+  FrameLog log;
+  protocol_.setFrameCallback(LogFrame, &log);
+  arduino::mock::SetMicros(0x10000);
+  SendByte(0x12);
+  arduino::mock::AdvanceMicros(0x1000);
+  SendByte(0x34);
+
+  // The bytes go to the callback instead of the buffer.
+  EXPECT_EQ(2, log.count);
+  EXPECT_EQ(0x12, log.bytes[0]);
+  EXPECT_EQ(0x34, log.bytes[1]);
+#if PS2_TIMESTAMPS
+  EXPECT_EQ(PS2Timestamp::fromMicros(0x10000), log.timestamps[0]);
+  EXPECT_EQ(PS2Timestamp::fromMicros(0x11000), log.timestamps[1]);
+#endif
+  EXPECT_EQ(0, protocol_.available());
+
+  // Clearing the callback resumes buffering.
+  protocol_.setFrameCallback(0);
+  SendByte(0x56);
+  EXPECT_EQ(2, log.count);
+  EXPECT_EQ(1, protocol_.available());
+  EXPECT_EQ(0x56, protocol_.read());
+}
+
+TEST_F(PS2ProtocolReceiveTests, ReadResponseSkipsAcks) {
+  SendByte(0xFA);
+  SendByte(0xAA);
+  EXPECT_EQ(0xAA, protocol_.readResponse());
+
+  // Nothing else arrives.
+  SendByte(0xFA);
+  EXPECT_EQ(-1, protocol_.readResponse(0));
+}
+
 TEST_F(PS2ProtocolReceiveTests, NoAvailableAftetEnd) {
   SendByte(0x12);
   protocol_.end();
@@ -151,8 +409,8 @@ class PS2ProtocolSendTests : public testing::TestCase {
 
  protected:
   bool SendByte(byte b, byte expected_parity) {
-    protocol_.write(b);
-    EXPECT_EQ(PS2Protocol::WAIT_S_DATA0, protocol_.getStateForTesting());
+    EXPECT_TRUE(protocol_.write(b));
+    RequestToSend();
 
     // Generate 8 clock bits to send the byte, plus one for the parity bit and
     // another for the stop bit.
@@ -171,15 +429,42 @@ class PS2ProtocolSendTests : public testing::TestCase {
 
     return true;
   }
+  void RequestToSend() {
+    // The clock and data lines are held low for 100usec before the ISR
+    // handler starts sending.
+    EXPECT_EQ(OUTPUT, arduino::mock::GetPinMode(2));
+    EXPECT_EQ(PS2Protocol::WRITE_PENDING, protocol_.writeStatus());
+    delayMicroseconds(100);
+    protocol_.poll();
+    EXPECT_EQ(PS2Protocol::WAIT_S_DATA0, protocol_.getStateForTesting());
+    EXPECT_EQ(INPUT_PULLUP, arduino::mock::GetPinMode(2));
+  }
   void GenerateClock() {
     protocol_.callIsrHandlerForTesting(LOW);
   }
   void GenerateAck(int bit) {
     protocol_.callIsrHandlerForTesting(bit);
   }
+  void SendAckedByte(byte b) {
+    RequestToSend();
+    for (int i = 0; i < 10; ++i)
+      GenerateClock();
+    GenerateAck(LOW);
+    protocol_.poll();
+  }
 
   bool ErrorHandlerCalled() { return error_handler_called_; }
 
+  static void WriteCallback(void* context, byte b,
+                            PS2Protocol::WriteStatus status) {
+    PS2ProtocolSendTests* self = static_cast<PS2ProtocolSendTests*>(context);
+    self->written_.push_back(b);
+    self->statuses_.push_back(status);
+  }
+
+  std::vector<byte> written_;
+  std::vector<PS2Protocol::WriteStatus> statuses_;
+
   PS2P_DECLARE(PS2ProtocolTests, protocol_);
  private:
   void SetUp() override {
@@ -198,6 +483,9 @@ TEST_F(PS2ProtocolSendTests, SendEvenParity) {
 
   // Make sure protocol is now idle.
   EXPECT_EQ(PS2Protocol::WAIT_R_START, protocol_.getStateForTesting());
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_DONE, protocol_.writeStatus());
+  EXPECT_EQ(0, protocol_.writePending());
 }
 
 TEST_F(PS2ProtocolSendTests, SendOddParity) {
@@ -220,4 +508,219 @@ TEST_F(PS2ProtocolSendTests, BadAck) {
 
   // Make sure protocol is now idle.
   EXPECT_EQ(PS2Protocol::WAIT_R_START, protocol_.getStateForTesting());
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_ERROR, protocol_.writeStatus());
+}
+
+TEST_F(PS2ProtocolSendTests, WriteDoesNotBlock) {
+  // Nothing is sent until the request-to-send has lasted 100usec.
+  EXPECT_TRUE(protocol_.write(0x12));
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WAIT_R_START, protocol_.getStateForTesting());
+  EXPECT_EQ(1, protocol_.writePending());
+  RequestToSend();
+}
+
+TEST_F(PS2ProtocolSendTests, QueueSeveralBytes) {
+  protocol_.setWriteCallback(WriteCallback, this);
+  const byte command[] = {0xED, 0x02};
+  EXPECT_TRUE(protocol_.write(command, 2));
+  EXPECT_EQ(2, protocol_.writePending());
+
+  SendAckedByte(0xED);
+  EXPECT_EQ(1, protocol_.writePending());
+  EXPECT_EQ(PS2Protocol::WRITE_PENDING, protocol_.writeStatus());
+
+  SendAckedByte(0x02);
+  EXPECT_EQ(0, protocol_.writePending());
+  EXPECT_EQ(PS2Protocol::WRITE_DONE, protocol_.writeStatus());
+
+  EXPECT_EQ(2, (int)written_.size());
+  EXPECT_EQ(0xED, written_[0]);
+  EXPECT_EQ(0x02, written_[1]);
+  EXPECT_EQ(PS2Protocol::WRITE_DONE, statuses_[1]);
+}
+
+TEST_F(PS2ProtocolSendTests, QueueFull) {
+  for (int i = 0; i < PS2Protocol::kWriteBufferSize; ++i)
+    EXPECT_TRUE(protocol_.write(i));
+  EXPECT_FALSE(protocol_.write(0xFF));
+
+  const byte command[] = {0xED, 0x02};
+  EXPECT_FALSE(protocol_.write(command, 2));
+  EXPECT_EQ(PS2Protocol::kWriteBufferSize, protocol_.writePending());
+}
+
+TEST_F(PS2ProtocolSendTests, StartTimeout) {
+  protocol_.setWriteCallback(WriteCallback, this);
+  const byte command[] = {0xED, 0x02};
+  EXPECT_TRUE(protocol_.write(command, 2));
+  RequestToSend();
+
+  // The device never starts generating the clock.
+  delay(14);
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_PENDING, protocol_.writeStatus());
+  delay(2);
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, protocol_.writeStatus());
+
+  // The remaining byte of the command is dropped and the lines released.
+  EXPECT_EQ(0, protocol_.writePending());
+  EXPECT_EQ(PS2Protocol::WAIT_R_START, protocol_.getStateForTesting());
+  EXPECT_EQ(INPUT_PULLUP, arduino::mock::GetPinMode(3));
+  EXPECT_EQ(2, (int)statuses_.size());
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, statuses_[0]);
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, statuses_[1]);
+}
+
+TEST_F(PS2ProtocolSendTests, TransferTimeout) {
+  EXPECT_TRUE(protocol_.write(0x12));
+  RequestToSend();
+
+  // The device starts generating the clock, but stops before the ACK.
+  delay(10);
+  GenerateClock();
+  GenerateClock();
+  delay(6);
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_PENDING, protocol_.writeStatus());
+  delay(2);
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, protocol_.writeStatus());
+}
+
+TEST_F(PS2ProtocolSendTests, WriteAndWaitTimeout) {
+  // Nothing clocks the bytes out, so this must not block forever.
+  EXPECT_FALSE(protocol_.writeAndWait(0x12));
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, protocol_.writeStatus());
+}
+
+TEST_F(PS2ProtocolSendTests, CommandFailsIfNotSent) {
+  const byte command[] = {0xF0, 0x02};
+  EXPECT_EQ(-1, protocol_.command(command, 2));
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, protocol_.writeStatus());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test recovering from errors with re-send (0xFE) commands.
+
+class PS2ProtocolResendTests : public testing::TestCase {
+ protected:
+  // Device sends a byte to the host, optionally with a bad parity bit.
+  void ReceiveByte(byte b, bool bad_parity) {
+    protocol_.callIsrHandlerForTesting(LOW);
+    int parity = 1;
+    for (int i = 0; i < 8; ++i) {
+      int bit = bitRead(b, i);
+      parity ^= bit;
+      protocol_.callIsrHandlerForTesting(bit);
+    }
+    protocol_.callIsrHandlerForTesting(bad_parity ? !parity : parity);
+    protocol_.callIsrHandlerForTesting(HIGH);
+  }
+  // Device clocks in the byte at the front of the write queue.
+  void ClockInWrittenByte() {
+    delayMicroseconds(100);
+    protocol_.poll();
+    EXPECT_EQ(PS2Protocol::WAIT_S_DATA0, protocol_.getStateForTesting());
+    for (int i = 0; i < 10; ++i)
+      protocol_.callIsrHandlerForTesting(LOW);
+    protocol_.callIsrHandlerForTesting(LOW);
+    protocol_.poll();
+  }
+
+  PS2P_DECLARE(PS2ProtocolResendTests, protocol_);
+ private:
+  void SetUp() override {
+    protocol_.begin(2, 3);
+    protocol_.setResendOnError(true);
+  }
+};
+
+PS2P_IMPLEMENT(PS2ProtocolResendTests, protocol_);
+
+TEST_F(PS2ProtocolResendTests, DisabledDropsFrame) {
+  protocol_.setResendOnError(false);
+  ReceiveByte(0x12, true);
+  protocol_.poll();
+  EXPECT_EQ(0, protocol_.writePending());
+  EXPECT_EQ(0, protocol_.available());
+  EXPECT_EQ(1, protocol_.getFramesDropped());
+  EXPECT_EQ(0, protocol_.getFramesRecovered());
+}
+
+TEST_F(PS2ProtocolResendTests, BadFrameRecovered) {
+  ReceiveByte(0x12, true);
+  EXPECT_EQ(0, protocol_.available());
+  EXPECT_EQ(1, protocol_.writePending());
+
+  // The host sends 0xFE and the device sends the byte again.
+  ClockInWrittenByte();
+  ReceiveByte(0x12, false);
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_DONE, protocol_.writeStatus());
+
+  EXPECT_EQ(1, protocol_.available());
+  EXPECT_EQ(0x12, protocol_.read());
+  EXPECT_EQ(1, protocol_.getFramesRecovered());
+  EXPECT_EQ(0, protocol_.getFramesDropped());
+}
+
+TEST_F(PS2ProtocolResendTests, BadFrameDroppedAfterRetries) {
+  ReceiveByte(0x12, true);
+  protocol_.poll();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(1, protocol_.writePending());
+    ClockInWrittenByte();
+    ReceiveByte(0x12, true);
+    protocol_.poll();
+  }
+
+  EXPECT_EQ(0, protocol_.writePending());
+  EXPECT_EQ(0, protocol_.available());
+  EXPECT_EQ(0, protocol_.getFramesRecovered());
+  EXPECT_EQ(1, protocol_.getFramesDropped());
+}
+
+TEST_F(PS2ProtocolResendTests, DeviceAsksForResend) {
+  EXPECT_TRUE(protocol_.write(0xED));
+  ClockInWrittenByte();
+  EXPECT_EQ(PS2Protocol::WRITE_PENDING, protocol_.writeStatus());
+
+  // Device did not get the byte right and asks for it again.  The 0xFE is
+  // not given to the reader.
+  ReceiveByte(0xFE, false);
+  protocol_.poll();
+  EXPECT_EQ(1, protocol_.getBytesResent());
+  EXPECT_EQ(0, protocol_.available());
+
+  ClockInWrittenByte();
+  ReceiveByte(0xFA, false);
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_DONE, protocol_.writeStatus());
+  EXPECT_EQ(1, protocol_.available());
+  EXPECT_EQ(0xFA, protocol_.read());
+}
+
+TEST_F(PS2ProtocolResendTests, WaitsForResponseBeforeNextByte) {
+  const byte command[] = {0xED, 0x02};
+  EXPECT_TRUE(protocol_.write(command, 2));
+  ClockInWrittenByte();
+
+  // The second byte is not started until the device answers the first.
+  delayMicroseconds(100);
+  protocol_.poll();
+  EXPECT_EQ(2, protocol_.writePending());
+  ReceiveByte(0xFA, false);
+  protocol_.poll();
+  EXPECT_EQ(1, protocol_.writePending());
+}
+
+TEST_F(PS2ProtocolResendTests, NoResponseTimeout) {
+  EXPECT_TRUE(protocol_.write(0xED));
+  ClockInWrittenByte();
+  delay(21);
+  protocol_.poll();
+  EXPECT_EQ(PS2Protocol::WRITE_TIMEOUT, protocol_.writeStatus());
 }
@@ -0,0 +1,69 @@
+
+#include <unit_tests.h>
+
+#include "ps2_ring_buffer.h"
+
+namespace {
+
+struct Pair {
+  byte a;
+  byte b;
+};
+
+}
+
+TEST(RingBufferEmpty) {
+  PS2RingBuffer<byte, 4> ring;
+  EXPECT_EQ(0, ring.available());
+  EXPECT_EQ(4, ring.space());
+  EXPECT_FALSE(ring.full());
+}
+
+TEST(RingBufferReadWrite) {
+  PS2RingBuffer<byte, 4> ring;
+  EXPECT_TRUE(ring.write(1));
+  EXPECT_TRUE(ring.write(2));
+  EXPECT_EQ(2, ring.available());
+  EXPECT_EQ(2, ring.space());
+  EXPECT_EQ(1, ring.peek());
+  EXPECT_EQ(1, ring.read());
+  EXPECT_EQ(2, ring.read());
+  EXPECT_EQ(0, ring.available());
+}
+
+TEST(RingBufferFull) {
+  // All slots of the buffer can be used.
+  PS2RingBuffer<byte, 4> ring;
+  for (int i = 0; i < 4; ++i)
+    EXPECT_TRUE(ring.write(i));
+  EXPECT_TRUE(ring.full());
+  EXPECT_FALSE(ring.write(4));
+  EXPECT_EQ(4, ring.available());
+
+  // The dropped value was the last one.
+  for (int i = 0; i < 4; ++i)
+    EXPECT_EQ(i, ring.read());
+}
+
+TEST(RingBufferWrapsAround) {
+  // The indices are free running bytes, go around them a few times.
+  PS2RingBuffer<Pair, 8> ring;
+  for (int i = 0; i < 1000; ++i) {
+    Pair p = {(byte)i, (byte)~i};
+    EXPECT_TRUE(ring.write(p));
+    EXPECT_TRUE(ring.write(p));
+    EXPECT_EQ(2, ring.available());
+    EXPECT_EQ((byte)i, ring.read().a);
+    EXPECT_EQ((byte)~i, ring.read().b);
+  }
+}
+
+TEST(RingBufferClear) {
+  PS2RingBuffer<byte, 128> ring;
+  for (int i = 0; i < 128; ++i)
+    EXPECT_TRUE(ring.write(i));
+  EXPECT_EQ(128, ring.available());
+  ring.clear();
+  EXPECT_EQ(0, ring.available());
+  EXPECT_EQ(128, ring.space());
+}
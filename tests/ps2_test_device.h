@@ -0,0 +1,97 @@
+#ifndef PS2_TEST_DEVICE_H_
+#define PS2_TEST_DEVICE_H_
+
+// Stand-in for a PS2 device on the other end of a PS2Protocol, shared by the
+// unit tests.
+
+#include <deque>
+#include <Arduino.h>
+
+#include "ps2_protocol.h"
+
+// Clocks |b| into |protocol|, as if sent by its device.
+inline void SendFrame(PS2Protocol* protocol, byte b) {
+  int parity = 1;
+  protocol->callIsrHandlerForTesting(LOW);
+  for (int i = 0; i < 8; ++i) {
+    int bit = (b >> i) & 1;
+    parity ^= bit;
+    protocol->callIsrHandlerForTesting(bit);
+  }
+  protocol->callIsrHandlerForTesting(parity);
+  protocol->callIsrHandlerForTesting(HIGH);
+}
+
+// Clocks |b| into the protocol on external interrupt |isr| with data pin
+// |data_pin|, as if sent by the device.
+inline void RaiseFrame(uint8_t isr, uint8_t data_pin, byte b) {
+  int parity = 1;
+  digitalWrite(data_pin, LOW);
+  arduino::mock::RaiseInterrupt(isr);
+  for (int i = 0; i < 8; ++i) {
+    int bit = (b >> i) & 1;
+    parity ^= bit;
+    digitalWrite(data_pin, bit);
+    arduino::mock::RaiseInterrupt(isr);
+  }
+  digitalWrite(data_pin, parity);
+  arduino::mock::RaiseInterrupt(isr);
+  digitalWrite(data_pin, HIGH);
+  arduino::mock::RaiseInterrupt(isr);
+}
+
+// Answers the commands written to a protocol.  Registered as a delay hook,
+// each delay() clocks in one bit of the bytes written by the host, and once
+// they are sent, clocks out the next byte queued with Respond().  The parity
+// of the bytes written is not checked.
+class PS2TestDevice : public arduino::mock::DelayHook {
+ public:
+  explicit PS2TestDevice(PS2Protocol* protocol) : protocol_(protocol) {}
+
+  // Records the bytes written from now on, see written().  Should be called
+  // once the protocol has begun.
+  void begin() {
+    protocol_->setWriteCallback(WriteCallback, this);
+  }
+
+  void SendByte(byte b) {
+    SendFrame(protocol_, b);
+  }
+
+  void SendBytes(const byte* bytes, int count) {
+    for (int i = 0; i < count; ++i)
+      SendByte(bytes[i]);
+  }
+
+  // Queues the bytes the device sends back once the host is done sending.
+  void Respond(const byte* bytes, int count) {
+    responses_.insert(responses_.end(), bytes, bytes + count);
+  }
+
+  bool responding() const { return !responses_.empty(); }
+
+  // Bytes the device acknowledged, oldest first.
+  const std::deque<byte>& written() const { return written_; }
+
+  void RunDelayHook() override {
+    if (protocol_->writeStatus() == PS2Protocol::WRITE_PENDING) {
+      protocol_->callIsrHandlerForTesting(LOW);
+    } else if (!responses_.empty()) {
+      SendByte(responses_.front());
+      responses_.pop_front();
+    }
+  }
+
+ private:
+  static void WriteCallback(void* context, byte b,
+                            PS2Protocol::WriteStatus status) {
+    if (status == PS2Protocol::WRITE_DONE)
+      static_cast<PS2TestDevice*>(context)->written_.push_back(b);
+  }
+
+  PS2Protocol* protocol_;
+  std::deque<byte> responses_;
+  std::deque<byte> written_;
+};
+
+#endif  // PS2_TEST_DEVICE_H_